@@ -2,8 +2,11 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct kstat;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -24,6 +27,11 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             kexec(struct proc*, char*, char**);
+struct inode*   execdup(struct inode*);
+void            execput(struct inode*);
+struct execseg* execseg(struct proc*, uint64, uint64);
+void*           execpage(struct proc*, struct execseg*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -61,9 +69,16 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
-void add_ref(void *pa);
+void*           kdup(void *);
+int             krefcnt(void *);
+void            kallocdump(void);
+void            kallocstat(struct kstat*);
+int             kzero_refill(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -71,7 +86,33 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     mmapvma(struct proc*, uint64);
+uint64          mmapfloor(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void*           mmappage(struct vma*, uint64);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
+int             madvise(uint64, uint64, int);
+
+// shm.c
+int             shmalloc(struct file**, uint64);
+uint64          shmsize(struct shm*);
+void*           shmpage(struct shm*, uint64);
+void            shmclose(struct shm*);
+
+// pcache.c
+void            pcacheinit(void);
+void*           pcachelookup(struct inode*, uint);
+void*           pcacheget(struct inode*, uint);
+void            pcacheupdate(struct inode*, uint, char*, uint);
+void            pcachedrop(struct inode*);
+int             pcachereclaim(int);
+void            pcachedump(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -86,6 +127,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -103,10 +145,20 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            procstat(struct kstat*);
+
+// swap.c
+void            swapinit(void);
+void            swapin(uint, char*);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapreclaim(int);
+void            swapdump(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -114,11 +166,21 @@ void            swtch(struct context*, struct context*);
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+void            slabdump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -148,6 +210,7 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -156,6 +219,10 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// uaccess.S
+int             uaccess_copy(void*, void*, uint64);
+int             uaccess_strcpy(char*, char*, uint64);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
@@ -164,13 +231,30 @@ int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
+uint64          uvmmapzero(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
+pte_t *         megapte(pagetable_t, uint64);
+int             uvmsplit(pagetable_t, uint64);
+void            vmdump(void);
+int             uvmasid(struct proc*);
+void            uvmflush(pagetable_t, uint64);
+void            uvmwin(struct proc*);
 uint64          walkaddr(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+char*           uvmkalloc(int);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64);
+pte_t           uvmpte(pagetable_t, uint64);
+int             uvmmapvma(pagetable_t, struct vma*);
+int             uvmpopulate(pagetable_t, uint64, uint64, int);
+void            uvmfreelater(pagetable_t, uint64);
+int             uvmreap(void);
+int             cow_fault(pagetable_t, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -184,6 +268,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -4,6 +4,9 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
@@ -21,15 +24,24 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return kexec(myproc(), path, argv);
+}
+
+// Replace p's user image with the program at path.
+// p is the caller, or a child that spawn() has yet
+// to let run. Returns argc, or -1 with p unchanged.
+int
+kexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -39,6 +51,12 @@ exec(char *path, char **argv)
   }
   ilock(ip);
 
+  // A program can't run while it's open for writing, nor be
+  // opened for writing while it runs (see sys_open()), so the
+  // page cache's copy of it can't change under execpage().
+  if(ip->nwrite > 0)
+    goto bad;
+
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
     goto bad;
@@ -49,7 +67,11 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program. The file's part of each segment is read
+  // in a page at a time as the program touches it (see
+  // execpage()), unless there are too many segments.
+  memset(seg, 0, sizeof(seg));
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -59,33 +81,53 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz || ph.vaddr + ph.memsz > MMAPTOP)
       goto bad;
     uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.filesz > 0 && nseg < NEXECSEG){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      seg[nseg].perm = flags2perm(ph.flags);
+      nseg++;
+      sz = ph.vaddr + ph.filesz;
+    } else {
+      if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.filesz, flags2perm(ph.flags))) == 0)
+        goto bad;
+      sz = sz1;
+      if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        goto bad;
+    }
+    // the rest of the segment (bss) maps the shared zero page.
+    if((sz1 = uvmmapzero(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
     sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
   }
-  iunlockput(ip);
+  // keep a reference to the file for execpage().
+  __sync_fetch_and_add(&ip->nexec, 1);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate some pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the rest as the user stack.
+  // Reserve USERSTACK pages at the next page boundary for the
+  // user stack, above an inaccessible guard page. Only the top
+  // page, which holds the arguments, is allocated now; the
+  // stack grows down into the rest as vmfault() fills it in.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
+  uint64 sz1, guard;
+  if((sz1 = uvmalloc(pagetable, sz, sz + PGSIZE, PTE_W)) == 0)
+    goto bad;
+  uvmclear(pagetable, sz);
+  guard = sz;
+  sz = sz1 + (USERSTACK-1)*PGSIZE;
+  if((sz1 = uvmalloc(pagetable, sz, sz + PGSIZE, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
   sp = sz;
-  stackbase = sp - USERSTACK*PGSIZE;
+  stackbase = sp - PGSIZE;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -121,12 +163,27 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  if(p == myproc())
+    mmapexit(p);
+  oldexe = p->exe;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asidgen = 0;   // the old ASID's TLB entries are for the old page table
+  p->faultnext = 0;
   p->sz = sz;
+  p->stackguard = guard;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  if(p == myproc())
+    uvmwin(p);
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    execput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,9 +194,90 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    execput(exe);
+    end_op();
+  }
   return -1;
 }
 
+// Take another reference to a running program's file,
+// for fork().
+struct inode*
+execdup(struct inode *ip)
+{
+  __sync_fetch_and_add(&ip->nexec, 1);
+  return idup(ip);
+}
+
+// Drop a reference to a running program's file.
+// Called inside a transaction.
+void
+execput(struct inode *ip)
+{
+  __sync_fetch_and_sub(&ip->nexec, 1);
+  iput(ip);
+}
+
+// The segment of p's program that holds file data in
+// [va, va+len), or 0 if none does.
+struct execseg*
+execseg(struct proc *p, uint64 va, uint64 len)
+{
+  struct execseg *s;
+
+  if(p->exe == 0)
+    return 0;
+  for(s = p->seg; s < &p->seg[NEXECSEG]; s++)
+    if(s->filesz && va < PGROUNDUP(s->va + s->filesz) && va + len > s->va)
+      return s;
+  return 0;
+}
+
+// Return a page holding what the page at va of segment s of
+// p's program starts out as, with a reference for the caller.
+// A page that is all file data is the page cache's, shared by
+// every process running the program; the caller must not
+// write to it. Otherwise it's a private copy, with the rest of
+// the segment's last page after the file data zero.
+// May sleep. Returns 0 if memory ran out or the read failed.
+void*
+execpage(struct proc *p, struct execseg *s, uint64 va)
+{
+  struct inode *ip = p->exe;
+  uint64 n;
+  uint off;
+  char *mem;
+  int locked;
+
+  va = PGROUNDDOWN(va);
+  off = s->off + (va - s->va);
+  n = s->va + s->filesz - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  // the fault may come from a copy to or from user memory
+  // by readi() or writei() on the program file itself. as in
+  // mmappage(), one with another sleep-lock held fails.
+  locked = holdingsleep(&ip->lock);
+  if(p->nsleep != locked)
+    return 0;
+  if(!locked)
+    ilock(ip);
+  mem = 0;
+  if(n == PGSIZE && off % PGSIZE == 0)
+    mem = pcacheget(ip, off);
+  if(mem == 0 && (mem = uvmkalloc(1)) != 0){
+    if(readi(ip, 0, (uint64)mem, off, n) < 0){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  if(!locked)
+    iunlock(ip);
+  return mem;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
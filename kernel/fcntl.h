@@ -3,3 +3,16 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() protection and flags
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+
+// madvise() advice
+#define MADV_DONTNEED 1  // drop the pages; they come back zero, or from the file
+#define MADV_WILLNEED 2  // fault the pages in now
+#define MADV_POPULATE 3  // fault them in writable, breaking copy-on-write
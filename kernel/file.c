@@ -75,7 +75,11 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_SHM){
+    shmclose(ff.shm);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable)
+      __sync_fetch_and_sub(&ff.ip->nwrite, 1);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -118,10 +122,19 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // a page fault in readi() can't read in a page of a
+    // mapped file or the program (see mmappage()), so fault
+    // the buffer in first. f->ip->size is only a hint here.
+    if(n > 0 && f->off < f->ip->size){
+      uint m = f->ip->size - f->off;
+      uvmpopulate(myproc()->pagetable, addr, addr + (n < m ? n : m), 1);
+    }
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+  } else if(f->type == FD_SHM){
+    return -1;   // only for mmap()
   } else {
     panic("fileread");
   }
@@ -159,6 +172,8 @@ filewrite(struct file *f, uint64 addr, int n)
       if(n1 > max)
         n1 = max;
 
+      // as in fileread().
+      uvmpopulate(myproc()->pagetable, addr + i, addr + i + n1, 0);
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
@@ -173,6 +188,8 @@ filewrite(struct file *f, uint64 addr, int n)
       i += r;
     }
     ret = (i == n ? n : -1);
+  } else if(f->type == FD_SHM){
+    return -1;   // only for mmap()
   } else {
     panic("filewrite");
   }
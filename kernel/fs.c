@@ -448,6 +448,7 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  pcachedrop(ip);
   ip->size = 0;
   iupdate(ip);
 }
@@ -473,6 +474,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -480,11 +483,24 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pa = pcachelookup(ip, off)) != 0){
+      // the cached page may have stores through mappings.
+      // copy all that's wanted of it at once, so that
+      // copyout() can see when a whole page is overwritten.
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, pa + off % PGSIZE, m);
+      kfree(pa);
+      if(r == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    m = min(n - tot, BSIZE - off%BSIZE);
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -523,6 +539,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcacheupdate(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
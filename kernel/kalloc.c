@@ -1,85 +1,339 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is kept by a buddy allocator: a free block of
+// order k is 2^k physically contiguous pages, aligned to its
+// size, and kmem.free[k] lists the free blocks of that order.
+// Freeing a block merges it with its buddy whenever the buddy
+// is free too. kalloc_pages() hands out whole blocks.
+//
+// Each hart keeps a small LIFO cache of free single pages so
+// that kalloc() and kfree() rarely touch kmem. Pages move
+// between a hart's cache and kmem in batches.
+//
+// Idle harts zero pages ahead of time into zpool, from which
+// kalloc_zeroed() serves callers that need a zero-filled page.
+//
+// Building with KMEMDEBUG fills freed and newly allocated
+// pages with junk to catch dangling references.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "page.h"
+#include "kstat.h"
 #include "defs.h"
 
+// pages moved between a hart's cache and kmem at a time.
+#define KBATCH 32
+// a hart's cache is drained back to kmem above this many pages.
+#define KHIGH  (2*KBATCH)
+// pre-zeroed pages kept for kalloc_zeroed().
+#define NZPOOL 256
+// pages an idle hart zeroes before looking for work again.
+#define ZBATCH 8
+
+#ifdef KMEMDEBUG
+#define JUNK(pa, c, n) memset((pa), (c), (n))
+#else
+#define JUNK(pa, c, n)
+#endif
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// free pages start with a struct run. buddy free lists
+// are circular and doubly linked through it; hart caches
+// only use next.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // list heads, one per order
+  int nfree[MAXORDER+1];        // free blocks of each order
+  uint64 fails[MAXORDER+1];     // kalloc_pages() failures per order
 } kmem;
 
-int * refcount;
-int pages;
+// per-hart page cache. the lock is only contended
+// when another hart steals pages from this one.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint64 hits;    // kalloc()s satisfied from this cache
+  uint64 misses;  // kalloc()s that had to refill from kmem
+};
+struct kcache kcache[NCPU];
 
-uint64 get_index(void *pa)
-{
-  return (uint64)(pa - (void *)end) / PGSIZE;
-}
+struct {
+  struct spinlock lock;
+  void *page[NZPOOL];   // zeroed pages, each with one reference
+  int n;
+  uint64 hits;          // kalloc_zeroed()s served from the pool
+  uint64 misses;        // kalloc_zeroed()s that had to memset
+} zpool;
+
+struct page pages[NPAGE];
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
-  int refcount_size = (PHYSTOP - (uint64)end) / (PGSIZE / sizeof(int) + 1);
-  pages = refcount_size / PGSIZE + 1;
+  for(int i = 0; i <= MAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
+  initlock(&zpool.lock, "zpool");
   freerange(end, (void*)PHYSTOP);
 }
 
+static void buddy_free(void *pa, int order);
+
 void
 freerange(void *pa_start, void *pa_end )
 {
   char *p;
+
+  // hand everything straight to kmem; the hart
+  // caches fill up on demand.
+  acquire(&kmem.lock);
   p = (char*)PGROUNDUP((uint64)pa_start);
-  // allocate refcount pages
-  refcount = (int*)p;
-  p += (pages) * PGSIZE;
-  memset(refcount, 0, pages * PGSIZE);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    JUNK(p, 1, PGSIZE);
+    buddy_free(p, 0);
+  }
+  release(&kmem.lock);
+}
+
+// Does the block of 2^order pages at pa lie
+// entirely in allocatable memory?
+static int
+buddy_inrange(uint64 pa, int order)
+{
+  return pa >= PGROUNDUP((uint64)end) &&
+         pa + ((uint64)PGSIZE << order) <= PHYSTOP;
+}
+
+static void
+buddy_insert(void *pa, int order)
+{
+  struct run *r = (struct run*)pa;
+  struct run *head = &kmem.free[order];
+  struct page *pg = PA2PG(pa);
+
+  pg->flags |= PG_BUDDY;
+  pg->order = order;
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+  kmem.nfree[order]++;
+}
+
+static void
+buddy_remove(void *pa, int order)
+{
+  struct run *r = (struct run*)pa;
+
+  PA2PG(pa)->flags &= ~PG_BUDDY;
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.nfree[order]--;
+}
+
+// Put a block of 2^order pages back on the free lists,
+// merging it with its buddy as long as the buddy is free.
+// Caller holds kmem.lock.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 a = (uint64)pa;
+  uint64 buddy;
+  struct page *bpg;
+
+  while(order < MAXORDER){
+    // blocks are aligned relative to KERNBASE, so
+    // flipping bit order of the page number gives the buddy.
+    buddy = KERNBASE + ((a - KERNBASE) ^ ((uint64)PGSIZE << order));
+    if(!buddy_inrange(buddy, order))
+      break;
+    bpg = PA2PG(buddy);
+    if((bpg->flags & PG_BUDDY) == 0 || bpg->order != order)
+      break;
+    buddy_remove((void*)buddy, order);
+    if(buddy < a)
+      a = buddy;
+    order++;
+  }
+  buddy_insert((void*)a, order);
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if need be.
+// Caller holds kmem.lock.
+static void*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nfree[k] > 0)
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  buddy_remove(r, k);
+  // give back the upper half until the block is small enough.
+  while(k > order){
+    k--;
+    buddy_insert((char*)r + ((uint64)PGSIZE << k), k);
+  }
+  return (void*)r;
+}
+
+// Move up to n pages from kmem to kc.
+// Caller holds kc->lock.
+static void
+krefill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(n-- > 0 && (r = buddy_alloc(0)) != 0){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Return all but the n most recently freed pages
+// of kc to kmem, so the cache-hot ones stay local.
+// Caller holds kc->lock.
+static void
+kdrain(struct kcache *kc, int n)
+{
+  struct run *keep, *r, *next;
+  int i;
+
+  if(n == 0){
+    r = kc->freelist;
+    kc->freelist = 0;
+  } else {
+    keep = kc->freelist;
+    for(i = 1; i < n && keep; i++)
+      keep = keep->next;
+    if(keep == 0)
+      return;
+    r = keep->next;
+    keep->next = 0;
+  }
+  if(r == 0)
+    return;
+  kc->nfree = n;
+
+  acquire(&kmem.lock);
+  for(; r; r = next){
+    next = r->next;
+    buddy_free(r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// kmem is empty: take a batch of pages from another
+// hart's cache. Returns one page and keeps the rest in kc.
+// Caller must not hold kc->lock, since two harts
+// may be stealing from each other.
+static struct run*
+ksteal(struct kcache *kc)
+{
+  struct kcache *victim;
+  struct run *r, *head;
+  int n;
+
+  for(victim = kcache; victim < &kcache[NCPU]; victim++){
+    if(victim == kc)
+      continue;
+    head = 0;
+    acquire(&victim->lock);
+    for(n = 0; n < KBATCH && (r = victim->freelist) != 0; n++){
+      victim->freelist = r->next;
+      victim->nfree--;
+      r->next = head;
+      head = r;
+    }
+    release(&victim->lock);
+    if(head == 0)
+      continue;
+
+    r = head;
+    head = head->next;
+    acquire(&kc->lock);
+    while(head){
+      struct run *next = head->next;
+      head->next = kc->freelist;
+      kc->freelist = head;
+      kc->nfree++;
+      head = next;
+    }
+    release(&kc->lock);
+    return r;
+  }
+  return 0;
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+//
+// pa may be shared (see kdup()); the page only goes back
+// on a free list when the last reference is dropped.
 void
 kfree(void *pa)
 {
-  int index = get_index(pa);
-  if(refcount[index] > 1){
-    refcount[index] -= 1;
-    return;
-  }
+  struct page *pg;
   struct run *r;
+  struct kcache *kc;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  refcount[index] = 0;
+  pg = PA2PG(pa);
+  if(pg->flags & PG_PINNED)
+    return;
+  if((n = __sync_sub_and_fetch(&pg->refcnt, 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: refcnt");
+
+  pgclearflags(pg, ~0);
+  pg->owner = 0;
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  JUNK(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->nfree > KHIGH)
+    kdrain(kc, KHIGH - KBATCH);
+  release(&kc->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -89,25 +343,258 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  if(kc->freelist){
+    kc->hits++;
+  } else {
+    kc->misses++;
+    krefill(kc, KBATCH);
+  }
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  if(r == 0)
+    r = ksteal(kc);
+  pop_off();
 
   if(r){
-    memset((char*)r, 5, PGSIZE); // fill with junk
-    int index = get_index((void*)r);
-    refcount[index] = 1;
+    JUNK((char*)r, 5, PGSIZE); // fill with junk
+    PA2PG(r)->refcnt = 1;
+    return (void*)r;
   }
 
+  // last resort: the pages set aside for kalloc_zeroed().
+  acquire(&zpool.lock);
+  if(zpool.n > 0)
+    r = zpool.page[--zpool.n];
+  release(&zpool.lock);
+  if(r)
+    pgclearflags(PA2PG(r), PG_ZERO);
   return (void*)r;
 }
 
-void 
-add_ref(void *pa)
+// Allocate one zero-filled page, preferably one
+// that an idle hart has already zeroed.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  void *pa = 0;
+
+  acquire(&zpool.lock);
+  if(zpool.n > 0){
+    pa = zpool.page[--zpool.n];
+    zpool.hits++;
+  } else {
+    zpool.misses++;
+  }
+  release(&zpool.lock);
+
+  if(pa){
+    pgclearflags(PA2PG(pa), PG_ZERO);
+  } else if((pa = kalloc()) != 0){
+    memset(pa, 0, PGSIZE);
+  }
+  return pa;
+}
+
+// Called by an idle hart's scheduler loop, with
+// interrupts enabled: zero up to ZBATCH free pages
+// into zpool. Returns the number of pages zeroed, so
+// the scheduler only sleeps once there is nothing to do.
+int
+kzero_refill(void)
+{
+  void *pa;
+  int n;
+
+  for(n = 0; n < ZBATCH; n++){
+    if(__atomic_load_n(&zpool.n, __ATOMIC_RELAXED) >= NZPOOL)
+      break;
+    if((pa = kalloc()) == 0)
+      break;
+    memset(pa, 0, PGSIZE);
+    pgsetflags(PA2PG(pa), PG_ZERO);
+    acquire(&zpool.lock);
+    if(zpool.n < NZPOOL){
+      zpool.page[zpool.n++] = pa;
+      pa = 0;
+    }
+    release(&zpool.lock);
+    if(pa){
+      kfree(pa);
+      break;
+    }
+  }
+  return n;
+}
+
+// Allocate 2^order physically contiguous pages,
+// aligned to their size. Every page of the block
+// starts with one reference, so the block may later
+// be freed as a whole with kfree_pages() or page by
+// page with kfree().
+// Returns 0 if no large enough block is free.
+void *
+kalloc_pages(int order)
+{
+  void *pa;
+  uint64 i;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+  if(pa == 0){
+    // pages parked in the hart caches may be
+    // keeping buddies from merging.
+    for(struct kcache *kc = kcache; kc < &kcache[NCPU]; kc++){
+      acquire(&kc->lock);
+      kdrain(kc, 0);
+      release(&kc->lock);
+    }
+    // so may zpool's pages; idle harts can zero more.
+    acquire(&zpool.lock);
+    acquire(&kmem.lock);
+    while(zpool.n > 0){
+      pa = zpool.page[--zpool.n];
+      PA2PG(pa)->refcnt = 0;
+      pgclearflags(PA2PG(pa), ~0);
+      buddy_free(pa, 0);
+    }
+    if((pa = buddy_alloc(order)) == 0)
+      kmem.fails[order]++;
+    release(&kmem.lock);
+    release(&zpool.lock);
+    if(pa == 0)
+      return 0;
+  }
+
+  JUNK(pa, 5, (uint64)PGSIZE << order); // fill with junk
+  for(i = 0; i < (1L << order); i++)
+    PA2PG((char*)pa + i*PGSIZE)->refcnt = 1;
+  return pa;
+}
+
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 i;
+  struct page *pg;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || !buddy_inrange((uint64)pa, order) ||
+     ((uint64)pa - KERNBASE) % ((uint64)PGSIZE << order) != 0)
+    panic("kfree_pages");
+
+  for(i = 0; i < (1L << order); i++){
+    pg = PA2PG((char*)pa + i*PGSIZE);
+    if(pg->refcnt != 1)
+      panic("kfree_pages: refcnt");
+    pg->refcnt = 0;
+    pgclearflags(pg, ~0);
+    pg->owner = 0;
+  }
+  JUNK(pa, 1, (uint64)PGSIZE << order);
+
+  acquire(&kmem.lock);
+  buddy_free(pa, order);
+  release(&kmem.lock);
+}
+
+// Take another reference to an allocated page,
+// e.g. to share it copy-on-write.  Each reference
+// is dropped with kfree().
+void*
+kdup(void *pa)
+{
+  struct page *pg = PA2PG(pa);
+
+  if((pg->flags & PG_PINNED) == 0 && __sync_fetch_and_add(&pg->refcnt, 1) < 1)
+    panic("kdup");
+  return pa;
+}
+
+// Number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&PA2PG(pa)->refcnt, __ATOMIC_RELAXED);
+}
+
+// Print each hart's page cache counters and the
+// buddy free lists.  For debugging.
+// No lock to avoid wedging a stuck machine further.
+void
+kallocdump(void)
 {
-  int index = get_index(pa);
-  refcount[index] += 1;
-}
\ No newline at end of file
+  struct kcache *kc;
+  uint64 nfree = 0;
+  int k, top = -1;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    if(kc->hits == 0 && kc->misses == 0)
+      continue;
+    printf("kcache %d: free %d hit %ld miss %ld\n",
+           (int)(kc - kcache), kc->nfree, kc->hits, kc->misses);
+  }
+
+  printf("zpool: %d zeroed, hit %ld miss %ld\n", zpool.n, zpool.hits, zpool.misses);
+
+  printf("buddy:");
+  for(k = 0; k <= MAXORDER; k++){
+    printf(" %d", kmem.nfree[k]);
+    nfree += (uint64)kmem.nfree[k] << k;
+    if(kmem.nfree[k])
+      top = k;
+  }
+  printf("\n");
+  // a large free total with a small top order means
+  // memory is fragmented.
+  printf("buddy: %ld pages free, largest block order %d\n", nfree, top);
+  for(k = 1; k <= MAXORDER; k++)
+    if(kmem.fails[k])
+      printf("buddy: order %d failed %ld times\n", k, kmem.fails[k]);
+}
+
+// Add up the free pages for kstat(). Takes every lock
+// that guards free pages, in order, so that none are
+// counted twice or missed as they move between lists.
+void
+kallocstat(struct kstat *ks)
+{
+  struct kcache *kc;
+  int k;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    ks->freepages += kc->nfree;
+  }
+  acquire(&zpool.lock);
+  ks->freepages += zpool.n;
+  acquire(&kmem.lock);
+  for(k = 0; k <= MAXORDER; k++){
+    ks->freepages += (uint64)kmem.nfree[k] << k;
+    if(k >= MEGAORDER)
+      ks->freemega += (uint64)kmem.nfree[k] << (k - MEGAORDER);
+  }
+  release(&kmem.lock);
+  release(&zpool.lock);
+  for(kc = kcache; kc < &kcache[NCPU]; kc++)
+    release(&kc->lock);
+}
@@ -0,0 +1,6 @@
+// Kernel statistics, as returned by kstat().
+struct kstat {
+  uint64 freepages;   // free physical pages, incl. hart caches
+  uint64 freemega;    // free 2 MB blocks in the buddy allocator
+  uint64 ncpu;        // harts running
+};
@@ -135,6 +135,10 @@ begin_op(void)
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      // end_op() woke only one waiter; pass the
+      // wakeup on if there is room for another.
+      if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS <= LOGSIZE)
+        wakeone(&log);
       release(&log.lock);
       break;
     }
@@ -159,7 +163,7 @@ end_op(void)
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeone(&log);
   }
   release(&log.lock);
 
@@ -169,7 +173,7 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
-    wakeup(&log);
+    wakeone(&log);
     release(&log.lock);
   }
 }
@@ -17,6 +17,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // small-object allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -27,7 +28,10 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pcacheinit();    // file pages for mmap()
+    pipeinit();      // pipe cache
     virtio_disk_init(); // emulated hard disk
+    swapinit();      // swap area after the file system
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
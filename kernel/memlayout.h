@@ -25,6 +25,11 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
 
+// core local interruptor (CLINT). the kernel uses only each
+// hart's machine-mode software interrupt bit, to interrupt it.
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hart) (CLINT + 4*(hart))
+
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -57,3 +62,14 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the kernel copies to and from the memory of the process
+// it is running for through the user window: the process's
+// first level-1 page table, mapped at USERWIN in each hart's
+// kernel page table. sbrk() can't grow a process past it.
+#define USERWIN     (1L << 37)
+#define USERWINSIZE (1L << 30)
+
+// mmap() places mappings downward from here, and the
+// heap grows up to meet them.
+#define MMAPTOP USERWINSIZE
@@ -0,0 +1,273 @@
+// Memory-mapped files.
+//
+// mmap() places each mapping below MMAPTOP, under the ones
+// before it, and records it in one of the process's struct
+// vmas. Its pages come in on demand through vmfault(), from
+// the page cache (pcache.c):
+//
+// * a MAP_SHARED mapping maps the cached page itself, writable
+//   if asked. munmap() writes the pages the hardware marked
+//   dirty (PTE_D) back to the file.
+// * a MAP_PRIVATE mapping maps the cached page copy-on-write,
+//   so that a store gets a private copy.
+//
+// Shared-memory segments (shm.c) are mapped in the same way,
+// but all at once when mmap()ed, and never written back.
+//
+// Mappings are inherited by fork(), and removed by exec()
+// and exit().
+//
+// madvise() works on mappings and on the heap alike.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+static int vmaunmap(struct proc*, struct vma*, uint64, uint64);
+
+// The mapping of p holding va, or 0.
+struct vma*
+mmapvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// The lowest address p has mapped; the heap can't grow past it.
+uint64
+mmapfloor(struct proc *p)
+{
+  struct vma *v;
+  uint64 floor = MMAPTOP;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < floor)
+      floor = v->addr;
+  return floor;
+}
+
+// Map len bytes of f from off. Returns the address.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 addr;
+
+  if(len == 0 || off % PGSIZE != 0 || !f->readable)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type == FD_SHM){
+    if(flags != MAP_SHARED || off + len > shmsize(f->shm))
+      return -1;
+  } else if(f->type != FD_INODE){
+    return -1;
+  }
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0)
+      free = v;
+  addr = mmapfloor(p);
+  if(free == 0 || PGROUNDUP(len) > addr || addr - PGROUNDUP(len) < PGROUNDUP(p->sz))
+    return -1;
+  addr -= PGROUNDUP(len);
+
+  free->addr = addr;
+  free->len = PGROUNDUP(len);
+  free->prot = prot;
+  free->flags = flags;
+  free->f = filedup(f);
+  free->off = off;
+  if(f->type == FD_SHM && uvmmapvma(p->pagetable, free) < 0){
+    vmaunmap(p, free, free->addr, free->len);
+    return -1;
+  }
+  return addr;
+}
+
+// Return the page of v's file that va maps, with a reference
+// for the caller, reading it in if need be. May sleep.
+// Returns 0 if va is past the end of the file.
+void*
+mmappage(struct vma *v, uint64 va)
+{
+  struct inode *ip = v->f->ip;
+  void *pa;
+  int locked;
+
+  if(v->f->type == FD_SHM)
+    return shmpage(v->f->shm, v->off + (PGROUNDDOWN(va) - v->addr));
+  // as in execpage(), the fault may come from readi()
+  // or writei() on the file itself. one from a copy with
+  // another i-node or a buffer locked mustn't lock ip too,
+  // lest it deadlock with a process locking the two the
+  // other way round; fail it. fileread() and filewrite()
+  // fault their buffers in first, so this is rare.
+  locked = holdingsleep(&ip->lock);
+  if(myproc()->nsleep != locked)
+    return 0;
+  if(!locked)
+    ilock(ip);
+  pa = pcacheget(ip, v->off + (PGROUNDDOWN(va) - v->addr));
+  if(!locked)
+    iunlock(ip);
+  return pa;
+}
+
+// Write the pages of [addr, addr+len) that p stored to through
+// the shared mapping v back to the file.
+static void
+writeback(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  struct inode *ip = v->f->ip;
+  uint64 a;
+  uint off, n;
+  pte_t pte;
+
+  if(v->flags != MAP_SHARED || (v->prot & PROT_WRITE) == 0 || v->f->type != FD_INODE)
+    return;
+  for(a = addr; a < addr + len; a += PGSIZE){
+    pte = uvmpte(p->pagetable, a);
+    if((pte & (PTE_V|PTE_D)) != (PTE_V|PTE_D))
+      continue;
+    off = v->off + (a - v->addr);
+    begin_op();
+    ilock(ip);
+    // mappings don't make the file grow.
+    if(off < ip->size){
+      n = ip->size - off;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      writei(ip, 0, PTE2PA(pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [addr, addr+len) of p's mapping v, which must be
+// all of it, or a piece from either end.
+static int
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;   // would leave a hole
+  writeback(p, v, addr, len);
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Act on advice for the pages of [addr, addr+len), which must
+// lie within the heap or within one mapping.
+int
+madvise(uint64 addr, uint64 len, int advice)
+{
+  struct proc *p = myproc();
+  struct vma *v = 0;
+  uint64 a;
+  pte_t pte;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  if(addr + len > PGROUNDUP(p->sz)){
+    if((v = mmapvma(p, addr)) == 0 || addr + len > v->addr + v->len)
+      return -1;
+  }
+
+  switch(advice){
+  case MADV_DONTNEED:
+    for(a = addr; a < addr + len; a += PGSIZE){
+      pte = uvmpte(p->pagetable, a);
+      if((pte & PTE_V) && (pte & PTE_U) == 0)
+        return -1;   // the stack guard page
+    }
+    if(v)
+      writeback(p, v, addr, len);
+    uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+    return 0;
+  case MADV_WILLNEED:
+    return uvmpopulate(p->pagetable, addr, addr + len, 0);
+  case MADV_POPULATE:
+    return uvmpopulate(p->pagetable, addr, addr + len, 1);
+  }
+  return -1;
+}
+
+// Unmap [addr, addr+len), which must lie within one mapping.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || (v = mmapvma(p, addr)) == 0)
+    return -1;
+  if(addr + len > v->addr + v->len)
+    return -1;
+  return vmaunmap(p, v, addr, len);
+}
+
+// Give the child np of fork() p's mappings. Their pages are
+// shared as the rest of p's memory is; see uvmcopy().
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  int i, j;
+
+  for(i = 0; i < NVMA; i++){
+    if(p->vma[i].len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, p->vma[i].addr,
+                    p->vma[i].addr + p->vma[i].len) < 0){
+      for(j = 0; j < i; j++){
+        if(np->vma[j].len){
+          uvmunmap(np->pagetable, np->vma[j].addr, np->vma[j].len / PGSIZE, 1);
+          fileclose(np->vma[j].f);
+          np->vma[j].len = 0;
+        }
+      }
+      return -1;
+    }
+    np->vma[i] = p->vma[i];
+    filedup(np->vma[i].f);
+  }
+  return 0;
+}
+
+// Remove all of p's mappings, as p exits or exec()s.
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len)
+      vmaunmap(p, v, v->addr, v->len);
+}
@@ -0,0 +1,46 @@
+// Per-page metadata, one entry for every physical page
+// from KERNBASE to PHYSTOP, indexed by physical page number.
+// refcnt and flags are only changed with atomic
+// memory operations (amoadd.w, amoor.w, amoand.w),
+// so no lock is needed to share a page between harts.
+// The one exception is kalloc.c setting refcnt with a plain
+// store on a page no one else can reach: one it is taking
+// off a free list, or one whose only reference kfree_pages()
+// or kalloc_pages() (emptying zpool) is dropping. order and owner belong to
+// whoever holds the page, and are plain fields.
+struct page {
+  int refcnt;        // number of references; 0 if free
+  uint flags;        // PG_* bits
+  int order;         // order of a free buddy block or kmalloc() block
+  void *owner;       // hint for the subsystem that owns the page
+};
+
+#define PG_ZERO   (1 << 0) // contents are known to be zero
+#define PG_COW    (1 << 1) // mapped copy-on-write by some page table
+#define PG_PINNED (1 << 2) // never freed; refcnt is not maintained
+#define PG_BUDDY  (1 << 3) // first page of a free buddy block
+#define PG_SLAB   (1 << 4) // slab page; owner is its kmem_cache
+#define PG_FILE   (1 << 5) // held by the page cache
+#define PG_SHARED (1 << 6) // shared-memory page; see shm.c
+
+#define MAXORDER  10       // largest buddy block is 2^MAXORDER pages
+#define MEGAORDER  9       // a 2 MB megapage is a block of this order
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+
+extern struct page pages[NPAGE];
+
+#define PA2PG(pa) (&pages[((uint64)(pa) - KERNBASE) >> PGSHIFT])
+#define PG2PA(pg) (KERNBASE + ((uint64)((pg) - pages) << PGSHIFT))
+
+static inline void
+pgsetflags(struct page *pg, uint f)
+{
+  __sync_fetch_and_or(&pg->flags, f);
+}
+
+static inline void
+pgclearflags(struct page *pg, uint f)
+{
+  __sync_fetch_and_and(&pg->flags, ~f);
+}
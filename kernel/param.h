@@ -1,6 +1,10 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NASID       128  // most ASIDs handed out before reusing them
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mmap()ed regions per process
+#define NEXECSEG      4  // program segments paged in on demand
+#define MAXSHM  (4*1024*1024)  // largest shared-memory segment, bytes
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
@@ -10,6 +14,8 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define SWAPSIZE     (64*1024)  // blocks of swap space, after the file system
 #define MAXPATH      128   // maximum file path name
-#define USERSTACK    1     // user stack pages
+#define USERSTACK    256   // most user stack pages; grown on demand
+#define FAULTAROUND  16    // most pages one page fault maps (power of 2)
 
@@ -0,0 +1,219 @@
+// Page cache: pages of file data, shared by every process
+// that maps them with mmap(), or that runs the program they
+// are part of (see execpage() in exec.c).
+//
+// A cached page is named by its inode and page-aligned offset.
+// The cache holds one reference to each page, and each PTE that
+// maps it holds another; PG_FILE marks pages still in the cache.
+//
+// The cached copy is the file's current contents, since stores
+// through MAP_SHARED mappings go straight to it: readi() reads
+// cached pages from it, and writei() updates it along with the
+// buffer cache. Those stores reach the disk when the mapping
+// goes away; see munmap(). Both need a file open for writing,
+// which a running program's file can't be (see kexec()), so
+// the pages execpage() maps never change underneath it.
+//
+// Pages that are no longer mapped stay cached until the file is
+// truncated, or until pcachereclaim() needs the memory.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
+#include "defs.h"
+
+#define NPCHASH 61
+
+struct pcentry {
+  uint dev;
+  uint inum;
+  uint off;            // page-aligned offset in the file
+  void *pa;
+  struct pcentry *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct pcentry *hash[NPCHASH];
+  int hand;            // bucket pcachereclaim() looks at next
+  int n;               // pages cached
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nreclaim;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct pcentry **
+bucket(struct inode *ip, uint off)
+{
+  return &pcache.hash[(ip->dev * 31 + ip->inum * 17 + off / PGSIZE) % NPCHASH];
+}
+
+// Find ip's cached page holding off, and take a reference to it.
+// Caller holds pcache.lock.
+static void*
+lookup(struct inode *ip, uint off)
+{
+  struct pcentry *e;
+
+  off = PGROUNDDOWN(off);
+  for(e = *bucket(ip, off); e; e = e->next){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off){
+      kdup(e->pa);
+      return e->pa;
+    }
+  }
+  return 0;
+}
+
+// Return ip's cached page holding off, with a reference
+// for the caller, or 0 if it isn't cached.
+void*
+pcachelookup(struct inode *ip, uint off)
+{
+  void *pa;
+
+  acquire(&pcache.lock);
+  pa = lookup(ip, off);
+  release(&pcache.lock);
+  return pa;
+}
+
+// Return ip's page at off, which must be page-aligned, with
+// a reference for the caller; read it in if it isn't cached.
+// Caller holds ip's lock, so no one else is reading it in.
+// Returns 0 if off is past the end of the file or memory ran out.
+void*
+pcacheget(struct inode *ip, uint off)
+{
+  struct pcentry *e, **b;
+  void *pa;
+
+  if(off >= ip->size)
+    return 0;
+  if((pa = pcachelookup(ip, off)) != 0){
+    __sync_fetch_and_add(&pcache.nhit, 1);
+    return pa;
+  }
+
+  if((pa = uvmkalloc(1)) == 0)
+    return 0;
+  if((e = kmalloc(sizeof(*e))) == 0){
+    kfree(pa);
+    return 0;
+  }
+  // the rest of the last page stays zero.
+  if(readi(ip, 0, (uint64)pa, off, PGSIZE) < 0){
+    kmfree(e);
+    kfree(pa);
+    return 0;
+  }
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->pa = pa;
+  pgsetflags(PA2PG(pa), PG_FILE);
+  kdup(pa);   // the caller's reference
+
+  acquire(&pcache.lock);
+  b = bucket(ip, off);
+  e->next = *b;
+  *b = e;
+  pcache.n++;
+  pcache.nmiss++;
+  release(&pcache.lock);
+  return pa;
+}
+
+// writei() wrote n bytes from src at off, all in one page,
+// to ip's blocks; write them to the cached page too.
+void
+pcacheupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  char *pa;
+
+  if((pa = pcachelookup(ip, off)) == 0)
+    return;
+  memmove(pa + off % PGSIZE, src, n);
+  kfree(pa);
+}
+
+// Unlink e from the cache and drop the cache's reference.
+// Caller holds pcache.lock.
+static void
+drop(struct pcentry **pe)
+{
+  struct pcentry *e = *pe;
+
+  *pe = e->next;
+  pgclearflags(PA2PG(e->pa), PG_FILE);
+  kfree(e->pa);
+  kmfree(e);
+  pcache.n--;
+}
+
+// ip's data is going away; forget its pages.
+// Mappings of them keep their own references.
+void
+pcachedrop(struct inode *ip)
+{
+  struct pcentry **pe;
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCHASH; i++){
+    for(pe = &pcache.hash[i]; *pe; ){
+      if((*pe)->dev == ip->dev && (*pe)->inum == ip->inum)
+        drop(pe);
+      else
+        pe = &(*pe)->next;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Free up to n cached pages that nobody maps.
+// Returns the number freed.
+int
+pcachereclaim(int n)
+{
+  struct pcentry **pe;
+  int i, freed;
+
+  freed = 0;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCHASH && freed < n; i++){
+    for(pe = &pcache.hash[pcache.hand]; *pe && freed < n; ){
+      if(krefcnt((*pe)->pa) == 1){
+        drop(pe);
+        freed++;
+      } else {
+        pe = &(*pe)->next;
+      }
+    }
+    if(freed < n)
+      pcache.hand = (pcache.hand + 1) % NPCHASH;
+  }
+  pcache.nreclaim += freed;
+  release(&pcache.lock);
+  return freed;
+}
+
+// Print page cache usage. For debugging.
+void
+pcachedump(void)
+{
+  printf("pcache: %d pages hit %ld miss %ld reclaimed %ld\n",
+         pcache.n, pcache.nhit, pcache.nmiss, pcache.nreclaim);
+}
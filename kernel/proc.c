@@ -4,6 +4,8 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "fs.h"
+#include "kstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -12,11 +14,39 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// per-hart queues of RUNNABLE processes, so that a hart finds
+// the next process to run without looking through proc[]. a
+// process joins the queue of the hart it last ran on, and a
+// hart whose queue is empty steals from the others'.
+// a queue's lock is acquired after any p->lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;    // runs next
+  struct proc *tail;
+  int len;
+  uint64 nrun;          // processes this hart switched to
+  uint64 nsteal;        // ... taken from another hart's queue
+  uint64 nmigrate;      // ... that last ran on another hart
+} runq[NCPU];
+
+// sleeping processes, in queues hashed by the channel they sleep
+// on, so that wakeup() only looks at processes that may be asleep
+// on its channel. each queue is in the order its processes went
+// to sleep. a queue's lock is acquired after the lock passed to
+// sleep(), and before any p->lock.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[((uint64)(chan) / 8) % NWAITQ])
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;    // asleep longest
+} waitq[NWAITQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void runqput(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -51,6 +81,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +158,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  push_off();
+  p->cpu = cpuid();
+  pop_off();
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -161,7 +198,13 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->asidgen = 0;
+  p->faultnext = 0;
+  p->faultwin = 0;
+  p->nfault = 0;
+  p->nfaultpages = 0;
   p->sz = 0;
+  p->stackguard = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -206,13 +249,14 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. That happens later,
+// on an idle hart; see uvmfreelater().
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmfree(pagetable, sz);
+  uvmfreelater(pagetable, sz);
 }
 
 // a user program that calls exec("/init")
@@ -249,26 +293,41 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runqput(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growth is lazy: pages are only allocated when
+// first touched (see vmfault() in vm.c). No process may
+// grow past all of memory and swap, but together they
+// may, on purpose: a process that touches a page no
+// memory is left for is killed (or its system call
+// fails, if the kernel touched it).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint64 sz;
   struct proc *p = myproc();
+  struct execseg *s;
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // refuse growth that could never be backed by memory
+    // and swap, counting what earlier calls asked for, or
+    // that would run into mmap()ed files.
+    if(sz + n > PHYSTOP - KERNBASE + (uint64)SWAPSIZE * BSIZE || sz + n > mmapfloor(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // the program's pages above sz are gone for good,
+    // not to be read in again if the heap grows back.
+    for(s = p->seg; s < &p->seg[NEXECSEG]; s++)
+      if(s->va + s->filesz > sz)
+        s->filesz = sz > s->va ? sz - s->va : 0;
   }
   p->sz = sz;
   return 0;
@@ -289,12 +348,13 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 || mmapfork(p, np) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  np->stackguard = p->stackguard;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -307,6 +367,9 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = execdup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -319,7 +382,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runqput(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +414,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // write back and unmap mmap()ed files.
+  mmapexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +428,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    execput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -391,7 +460,7 @@ int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -408,12 +477,18 @@ wait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          // copy out with no locks held, since the page
+          // may have to be read back from swap. if it
+          // fails, leave the child for a later wait().
+          // only p waits for pp, so it stays a zombie.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -434,10 +509,65 @@ wait(uint64 addr)
   }
 }
 
+// Make p RUNNABLE, at the end of the run queue of the
+// hart it last ran on. Caller must hold p->lock.
+static void
+runqput(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->len++;
+  release(&rq->lock);
+
+  // a hart in wfi wouldn't look at its queue until its next
+  // timer interrupt. pairs with the fence in scheduler().
+  __sync_synchronize();
+  if(p->cpu != cpuid() && __atomic_load_n(&cpus[p->cpu].idle, __ATOMIC_RELAXED))
+    ipi(p->cpu);
+}
+
+// Take the process at the head of rq, or return 0.
+static struct proc*
+runqget(struct runq *rq)
+{
+  struct proc *p;
+
+  if(__atomic_load_n(&rq->len, __ATOMIC_RELAXED) == 0)
+    return 0;
+  acquire(&rq->lock);
+  if((p = rq->head) != 0){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    rq->len--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Is there a process waiting in any hart's run queue?
+static int
+runqready(void)
+{
+  for(struct runq *rq = runq; rq < &runq[NCPU]; rq++)
+    if(__atomic_load_n(&rq->len, __ATOMIC_RELAXED) > 0)
+      return 1;
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this hart's run
+//    queue, or else from another hart's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,6 +576,8 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  struct runq *rq = &runq[id];
 
   c->proc = 0;
   for(;;){
@@ -454,28 +586,52 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
+    if((p = runqget(rq)) == 0){
+      for(int i = 1; i < NCPU && p == 0; i++)
+        p = runqget(&runq[(id + i) % NCPU]);
+      if(p)
+        rq->nsteal++;
+    }
+    if(p){
+      // the hart p last ran on may still be on its way
+      // out of it; this waits for that.
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+      if(p->state != RUNNABLE)
+        panic("scheduler: not runnable");
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      if(p->cpu != id){
+        p->cpu = id;
+        rq->nmigrate++;
       }
+      rq->nrun++;
+      p->state = RUNNING;
+      c->proc = p;
+      uvmwin(p);
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
       release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+    } else {
+      // nothing to run; free the memory of exited processes,
+      // then zero some free pages for kalloc_zeroed(), and once
+      // there are enough, stop running on this core until an
+      // interrupt. runqput() interrupts a hart that says it's
+      // idle, so say so before the last look at the queues.
+      // wfi wakes for a pending interrupt even with interrupts
+      // off, and the intr_on() above then takes it.
       intr_on();
-      asm volatile("wfi");
+      if(uvmreap() == 0 && kzero_refill() == 0){
+        intr_off();
+        __atomic_store_n(&c->idle, 1, __ATOMIC_RELAXED);
+        __sync_synchronize();
+        if(!runqready())
+          asm volatile("wfi" ::: "memory");
+        __atomic_store_n(&c->idle, 0, __ATOMIC_RELAXED);
+      }
     }
   }
 }
@@ -513,11 +669,59 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p);
   sched();
   release(&p->lock);
 }
 
+// Create a new process running the program at path, with
+// the caller's open files and current directory, as fork()
+// followed by exec() in the child would, but without copying
+// the caller's memory only to throw the copy away.
+// Returns the child's pid, or -1 if the program can't be run.
+int
+spawn(char *path, char **argv)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // np isn't RUNNABLE, so no one else looks at it.
+  release(&np->lock);
+
+  // start from our registers, as after fork(), so as not to
+  // hand the child whatever the trapframe page last held.
+  *(np->trapframe) = *(p->trapframe);
+
+  if((argc = kexec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  runqput(np);
+  release(&np->lock);
+
+  return pid;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -548,21 +752,31 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the wait queue),
   // so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
-  // Go to sleep.
+  // Go to sleep, at the end of the queue.
   p->chan = chan;
   p->state = SLEEPING;
-
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext)
+    ;
+  p->wqnext = 0;
+  *pp = p;
+  release(&wq->lock);
+
+  // wakeup() takes p off the queue, then waits
+  // for p->lock, so p is off this hart by then.
   sched();
 
   // Tidy up.
@@ -573,22 +787,52 @@ sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Wake up the processes sleeping on chan; with one set,
+// just the first. Returns the number woken.
+static int
+wake(void *chan, int one)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc **pp, *q;
+  int n = 0;
+
+  acquire(&wq->lock);
+  for(pp = &wq->head; (q = *pp) != 0; ){
+    if(q->chan != chan){
+      pp = &q->wqnext;
+      continue;
+    }
+    *pp = q->wqnext;
+    acquire(&q->lock);
+    if(q->state != SLEEPING)
+      panic("wake");
+    runqput(q);
+    release(&q->lock);
+    n++;
+    if(one)
+      break;
+  }
+  release(&wq->lock);
+  return n;
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wake(chan, 0);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
-  }
+// Wake up just the process that has slept longest on chan,
+// for a channel whose waiters each want something that
+// only one may get. A waiter that gets it and sees more
+// left over must call wakeone() again to pass it on.
+// Must be called without any p->lock.
+void
+wakeone(void *chan)
+{
+  wake(chan, 1);
 }
 
 // Kill the process with the given pid.
@@ -597,15 +841,34 @@ wakeup(void *chan)
 int
 kill(int pid)
 {
-  struct proc *p;
+  struct proc *p, **pp;
+  struct waitq *wq;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+      // Wake process from sleep(). Take the locks in
+      // sleep()'s order, then make sure it still sleeps
+      // on the same channel; if it has gone to sleep on
+      // another meanwhile, go after that one.
+      while(p->state == SLEEPING){
+        chan = p->chan;
+        wq = WAITQ(chan);
+        release(&p->lock);
+        acquire(&wq->lock);
+        acquire(&p->lock);
+        if(p->pid == pid && p->state == SLEEPING && p->chan == chan){
+          for(pp = &wq->head; *pp != p; pp = &(*pp)->wqnext)
+            if(*pp == 0)
+              panic("kill: not queued");
+          *pp = p->wqnext;
+          runqput(p);
+        }
+        release(&wq->lock);
+        if(p->pid != pid)
+          break;   // it exited and p was reused
       }
       release(&p->lock);
       return 0;
@@ -690,6 +953,27 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" faults %ld pages %ld", p->nfault, p->nfaultpages);
     printf("\n");
   }
+  for(int i = 0; i < NCPU; i++){
+    if(runq[i].nrun == 0)
+      continue;
+    printf("cpu %d: runq %d ran %ld stole %ld migrated %ld\n", i,
+           runq[i].len, runq[i].nrun, runq[i].nsteal, runq[i].nmigrate);
+  }
+  kallocdump();
+  slabdump();
+  swapdump();
+  pcachedump();
+  vmdump();
+}
+
+// Fill in ks's scheduling statistics for kstat().
+void
+procstat(struct kstat *ks)
+{
+  for(int i = 0; i < NCPU; i++)
+    if(cpus[i].pagetable)
+      ks->ncpu++;   // kvminithart() has run
 }
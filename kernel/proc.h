@@ -24,6 +24,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was last flushed for
+  pagetable_t pagetable;      // kernel page table, with this hart's user window
+  int idle;                   // in scheduler()'s wfi, or about to be
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +84,26 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of a file that a process has mmap()ed.
+struct vma {
+  uint64 addr;                 // page-aligned start
+  uint64 len;                  // bytes, page-aligned; 0 if unused
+  int prot;                    // PROT_*
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;
+  uint off;                    // file offset of addr
+};
+
+// The part of an ELF segment of a process's program that comes
+// from the file. exec() leaves it unmapped, and vmfault() reads
+// in each page as it is first touched; see execpage().
+struct execseg {
+  uint64 va;                   // page-aligned start
+  uint64 filesz;               // bytes from the file; 0 if unused
+  uint off;                    // file offset of va
+  int perm;                    // PTE_X, PTE_W for the segment
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,6 +114,14 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int kpreempted;              // yielded from kerneltrap(); pages not swappable
+  int cpu;                     // hart it last ran on, whose run queue it joins
+
+  // its run queue's lock must be held when using this:
+  struct proc *rqnext;         // next RUNNABLE process in the queue
+
+  // its wait queue's lock must be held when using this:
+  struct proc *wqnext;         // next process asleep in the queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -98,10 +129,22 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 stackguard;           // user stack's guard page; 0 if none
   pagetable_t pagetable;       // User page table
+  int asid;                    // TLB tag for pagetable, if asidgen is current
+  uint64 asidgen;              // ASID generation asid belongs to; 0 if none
+  uint64 asidharts;            // harts that may cache translations for asid
+  uint64 faultnext;            // page fault that would continue a sequence
+  int faultwin;                // pages the last page fault handled
+  uint64 nfault;               // page faults taken
+  uint64 nfaultpages;          // pages they mapped
+  int nsleep;                  // sleep-locks held
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // mmap()ed files
+  struct inode *exe;           // program file, for seg
+  struct execseg seg[NEXECSEG]; // its segments not yet read in
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
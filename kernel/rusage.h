@@ -0,0 +1,5 @@
+// Resource usage of the calling process, as returned by getrusage().
+struct rusage {
+  uint64 nfault;      // page faults taken
+  uint64 nfaultpages; // ... and the pages they mapped
+};
@@ -0,0 +1,99 @@
+// Anonymous shared memory.
+//
+// shmcreate() makes a segment of zeroed pages and returns a file
+// descriptor for it. Every process that has the descriptor, by
+// fork() or dup(), may mmap() it MAP_SHARED, which maps the very
+// same pages with mappages() right away. The pages are PG_SHARED,
+// so fork() leaves them writable rather than copy-on-write.
+//
+// The segment holds one reference to each page and each mapping
+// another; a mapping keeps the file open, and the segment goes
+// away with the file's last reference.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
+#include "defs.h"
+
+struct shm {
+  uint npages;
+  void *page[];
+};
+
+static void
+shmfree(struct shm *shm)
+{
+  uint i;
+
+  for(i = 0; i < shm->npages; i++)
+    if(shm->page[i])
+      kfree(shm->page[i]);
+  kmfree(shm);
+}
+
+// Make a segment of size bytes and a file for it.
+int
+shmalloc(struct file **f, uint64 size)
+{
+  struct shm *shm;
+  uint i, n;
+
+  if(size == 0 || size > MAXSHM)
+    return -1;
+  n = PGROUNDUP(size) / PGSIZE;
+  if((*f = filealloc()) == 0)
+    return -1;
+  if((shm = kmalloc(sizeof(*shm) + n * sizeof(void*))) == 0){
+    fileclose(*f);
+    return -1;
+  }
+  shm->npages = n;
+  memset(shm->page, 0, n * sizeof(void*));
+  for(i = 0; i < n; i++){
+    if((shm->page[i] = uvmkalloc(1)) == 0){
+      shmfree(shm);
+      fileclose(*f);
+      return -1;
+    }
+    pgsetflags(PA2PG(shm->page[i]), PG_SHARED);
+  }
+  (*f)->type = FD_SHM;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->shm = shm;
+  return 0;
+}
+
+// The segment's size in bytes.
+uint64
+shmsize(struct shm *shm)
+{
+  return (uint64)shm->npages * PGSIZE;
+}
+
+// Return the segment's page at off, with a reference for the
+// caller, or 0 if off is past the end.
+void*
+shmpage(struct shm *shm, uint64 off)
+{
+  void *pa;
+
+  if(off >= shmsize(shm))
+    return 0;
+  pa = shm->page[off / PGSIZE];
+  kdup(pa);
+  return pa;
+}
+
+// The segment's file has been closed for the last time.
+void
+shmclose(struct shm *shm)
+{
+  shmfree(shm);
+}
@@ -0,0 +1,304 @@
+// Slab allocator for kernel objects smaller than a page.
+//
+// A kmem_cache hands out objects of one size. It carves
+// pages from kalloc() into slabs: a struct slab header at
+// the start of the page followed by equal-sized objects,
+// the free ones linked through their first word.
+//
+// Each hart keeps a small stack of free objects per cache,
+// so most allocations and frees don't take the cache lock.
+//
+// kmalloc()/kmfree() serve arbitrary sizes from a set of
+// power-of-two caches, KMALLOC_MIN to KMALLOC_MAX bytes, and
+// fall back to whole blocks from kalloc_pages() for anything
+// larger than KMALLOC_MAX.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a cache at boot.
+// * kmem_cache_alloc()/kmem_cache_free() for its objects.
+// * kmalloc(n)/kmfree(p) for everything else.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "page.h"
+#include "defs.h"
+
+#define NCACHE   16   // maximum number of caches
+#define NMAG     16   // free objects a hart keeps per cache
+#define KMALLOC_MIN   16
+#define KMALLOC_MAX 1024
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;   // slabs with free objects
+  struct slab *prev;
+  void *freelist;      // free objects in this slab
+  int inuse;           // allocated objects, incl. hart caches
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // object size, rounded up
+  int perslab;         // objects per slab
+  struct slab partial; // head of list of slabs with free objects
+
+  int nslab;           // slabs owned by this cache
+
+  // per-hart free objects and statistics.
+  // only touched by the hart itself, with interrupts off.
+  struct {
+    void *obj[NMAG];
+    int n;
+    uint64 nalloc;     // objects handed out
+    uint64 nhit;       // ... of which came from obj[]
+    uint64 nfree;      // objects given back
+  } mag[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+// one kmalloc cache per power of two, KMALLOC_MIN to KMALLOC_MAX.
+static char *kmalloc_names[] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+static struct kmem_cache *kmalloc_caches[NELEM(kmalloc_names)];
+
+void
+slabinit(void)
+{
+  uint sz;
+  int i;
+
+  initlock(&slabs.lock, "slabs");
+  for(i = 0, sz = KMALLOC_MIN; i < NELEM(kmalloc_caches); i++, sz *= 2)
+    kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], sz);
+  if(sz / 2 != KMALLOC_MAX)
+    panic("slabinit: kmalloc_names");
+}
+
+// Make a cache of objects of the given size.
+// Caches live forever.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 15) & ~15;  // keep objects 16-byte aligned
+  if(size == 0 || sizeof(struct slab) + size > PGSIZE)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, "kmem_cache");
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial.next = c->partial.prev = &c->partial;
+  return c;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+// Carve a fresh page into a slab for c.
+// Caller holds c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)s + PGSIZE - c->perslab * c->size;
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  pgsetflags(PA2PG(s), PG_SLAB);
+  PA2PG(s)->owner = c;
+  c->nslab++;
+  slab_link(c, s);
+  return s;
+}
+
+// Move up to n free objects from c's slabs into objs.
+// Returns the number moved. Caller holds c->lock.
+static int
+slab_take(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  int i = 0;
+
+  while(i < n){
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_grow(c)) == 0)
+      break;
+    while(i < n && s->freelist){
+      objs[i++] = s->freelist;
+      s->freelist = *(void**)s->freelist;
+      s->inuse++;
+    }
+    if(s->freelist == 0)
+      slab_unlink(s);
+  }
+  return i;
+}
+
+// Return n objects to their slabs, freeing slabs that
+// become empty as long as another slab has free objects.
+// Caller holds c->lock.
+static void
+slab_give(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  int i;
+
+  for(i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint64)objs[i]);
+    if(s->freelist == 0)
+      slab_link(c, s);   // was full
+    *(void**)objs[i] = s->freelist;
+    s->freelist = objs[i];
+    if(--s->inuse == 0 && (s->next != &c->partial || s->prev != &c->partial)){
+      slab_unlink(s);
+      pgclearflags(PA2PG(s), PG_SLAB);
+      c->nslab--;
+      kfree(s);
+    }
+  }
+}
+
+// Allocate one object from c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == 0){
+    acquire(&c->lock);
+    c->mag[id].n = slab_take(c, c->mag[id].obj, NMAG/2);
+    release(&c->lock);
+  } else {
+    c->mag[id].nhit++;
+  }
+  if(c->mag[id].n > 0){
+    obj = c->mag[id].obj[--c->mag[id].n];
+    c->mag[id].nalloc++;
+  }
+  pop_off();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == NMAG){
+    // keep the most recently freed half.
+    acquire(&c->lock);
+    slab_give(c, c->mag[id].obj, NMAG/2);
+    release(&c->lock);
+    memmove(c->mag[id].obj, c->mag[id].obj + NMAG/2, (NMAG/2) * sizeof(void*));
+    c->mag[id].n -= NMAG/2;
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  c->mag[id].nfree++;
+  pop_off();
+}
+
+// Allocate n bytes of kernel memory.
+// Returns 0 if out of memory.
+void*
+kmalloc(uint n)
+{
+  uint sz;
+  int i, order;
+  void *pa;
+
+  for(i = 0, sz = KMALLOC_MIN; i < NELEM(kmalloc_caches); i++, sz *= 2)
+    if(n <= sz)
+      return kmem_cache_alloc(kmalloc_caches[i]);
+
+  for(order = 0; ((uint64)PGSIZE << order) < n; order++)
+    ;
+  if((pa = kalloc_pages(order)) == 0)
+    return 0;
+  PA2PG(pa)->order = order;
+  return pa;
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *p)
+{
+  struct page *pg = PA2PG(PGROUNDDOWN((uint64)p));
+
+  if(pg->flags & PG_SLAB)
+    kmem_cache_free(pg->owner, p);
+  else
+    kfree_pages(p, pg->order);
+}
+
+// Print each cache's usage.  For debugging.
+// No lock to avoid wedging a stuck machine further.
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+  uint64 nalloc, nhit, nfree;
+  int i;
+
+  for(c = slabs.cache; c < &slabs.cache[slabs.n]; c++){
+    nalloc = nhit = nfree = 0;
+    for(i = 0; i < NCPU; i++){
+      nalloc += c->mag[i].nalloc;
+      nhit += c->mag[i].nhit;
+      nfree += c->mag[i].nfree;
+    }
+    if(nalloc == 0)
+      continue;
+    printf("%s: size %d active %ld slabs %d (%d objs) alloc %ld hit %ld\n",
+           c->name, c->size, nalloc - nfree, c->nslab, c->nslab * c->perslab,
+           nalloc, nhit);
+  }
+}
@@ -6,10 +6,17 @@
 
 void main();
 void timerinit();
+void ipiinit();
+
+// in kernelvec.S, runs in machine mode.
+void ipivec();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// a scratch area per CPU for ipivec in kernelvec.S.
+uint64 ipiscratch[NCPU][2];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -40,6 +47,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let other harts interrupt this one.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -64,3 +74,23 @@ timerinit()
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
 }
+
+// other harts interrupt this one by setting its software
+// interrupt bit in the CLINT (see ipi() in trap.c). that's a
+// machine-mode interrupt, which can't be delegated; ipivec
+// clears the bit and passes it on as a supervisor software
+// interrupt.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  // ipivec saves a register in scratch[0], and finds
+  // the hart's CLINT bit in scratch[1].
+  uint64 *scratch = &ipiscratch[id][0];
+  scratch[1] = CLINT_MSIP(id);
+  w_mscratch((uint64)scratch);
+
+  w_mtvec((uint64)ipivec);
+  w_mie(r_mie() | MIE_MSIE);
+}
@@ -0,0 +1,256 @@
+// Swapping of user pages to disk.
+//
+// The swap area is the SWAPSIZE blocks of the root disk that
+// follow the file system, divided into page-sized slots.
+//
+// When kalloc() runs dry, swapreclaim() sweeps a clock hand
+// over the user address spaces: a page the hardware has marked
+// accessed (PTE_A) since the last sweep loses the mark and is
+// spared once; otherwise it is written to a free slot and freed.
+// The PTE is left invalid with PTE_SWAP set and the slot number
+// in place of the PPN; vmfault() reads it back on the next touch.
+//
+// Only private pages (not copy-on-write, one reference) are
+// evicted, and only from processes that are not running, or
+// from the reclaiming process itself, so that nobody holds a
+// physical address for an evicted page.
+//
+// A slot is referenced by every PTE that names it; fork()
+// shares slots rather than reading them back in.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "page.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)      // disk blocks per slot
+#define NSLOT      (SWAPSIZE / SLOTBLOCKS)
+#define SWAPSTART  FSSIZE                // first block of swap
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  ushort ref[NSLOT];    // PTEs naming each slot; 0 if free
+  void *page[NSLOT];    // page being written out to the slot, or 0
+  int next;             // where to start looking for a free slot
+  int nused;
+  uint64 nout;          // pages written out
+  uint64 nin;           // pages read back in
+  uint64 nfull;         // evictions given up for lack of slots
+
+  // clock hand, protected by the sleep-lock so that only one
+  // hart at a time reclaims and writes out pages.
+  struct sleeplock clock;
+  int hand;             // index into proc[]
+  uint64 va;            // next address to look at in proc[hand]
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.clock, "swapclock");
+}
+
+// Take a free slot to write pa out to.
+// Returns the slot, or -1 if swap is full.
+static int
+slotalloc(void *pa)
+{
+  int i, slot;
+
+  acquire(&swap.lock);
+  for(i = 0; i < NSLOT; i++){
+    slot = (swap.next + i) % NSLOT;
+    if(swap.ref[slot] == 0 && swap.page[slot] == 0){
+      swap.ref[slot] = 1;
+      swap.page[slot] = pa;
+      swap.next = slot + 1;
+      swap.nused++;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  swap.nfull++;
+  release(&swap.lock);
+  return -1;
+}
+
+// Drop a reference to slot.
+// Caller holds swap.lock.
+static void
+slotput(int slot)
+{
+  if(swap.ref[slot] == 0)
+    panic("swap: ref");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+}
+
+// Another PTE names slot, e.g. in a child after fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE naming slot has gone away.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  slotput(slot);
+  release(&swap.lock);
+}
+
+// Read slot into the page mem, and drop the caller's
+// reference to it. May sleep.
+void
+swapin(uint slot, char *mem)
+{
+  acquire(&swap.lock);
+  if(swap.page[slot]){
+    // still being written out; the page is intact.
+    memmove(mem, swap.page[slot], PGSIZE);
+    slotput(slot);
+    swap.nin++;
+    release(&swap.lock);
+    return;
+  }
+  release(&swap.lock);
+
+  // our reference keeps the slot from being reused.
+  virtio_disk_rwpage(SWAPSTART + slot * SLOTBLOCKS, mem, 0);
+
+  acquire(&swap.lock);
+  slotput(slot);
+  swap.nin++;
+  release(&swap.lock);
+}
+
+// May p's pages be taken away from it? Not while it runs on
+// another hart, nor while it sits preempted in the kernel,
+// where it may hold a physical address from its page table.
+static int
+evictable(struct proc *p)
+{
+  if(p->pagetable == 0)
+    return 0;
+  if(p == myproc())
+    return 1;
+  return p->state == SLEEPING || (p->state == RUNNABLE && !p->kpreempted);
+}
+
+// Is pte a page swapping may take away?
+static int
+swappable(pte_t pte)
+{
+  struct page *pg;
+
+  if((pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (pte & PTE_COW))
+    return 0;
+  pg = PA2PG(PTE2PA(pte));
+  return pg->refcnt == 1 && (pg->flags & PG_PINNED) == 0;
+}
+
+// Write out and free up to n user pages.
+// Returns the number freed; 0 means memory is really gone.
+// Must not be called with spinlocks held.
+int
+swapreclaim(int n)
+{
+  struct proc *p;
+  pte_t *pte;
+  void *pa;
+  int freed, scanned, slot, done;
+
+  freed = 0;
+  scanned = 0;
+  acquiresleep(&swap.clock);
+  // two sweeps over all of memory are enough to find
+  // pages whose PTE_A was cleared by the first.
+  while(freed < n && scanned < 2 * NPAGE + NPROC){
+    p = &proc[swap.hand];
+    pa = 0;
+    slot = -1;
+    done = 1;
+    acquire(&p->lock);
+    if(evictable(p)){
+      done = 0;
+      for(; swap.va < p->sz; swap.va += PGSIZE){
+        if(++scanned % 1024 == 0)
+          break;   // let interrupts in now and then
+        if(megapte(p->pagetable, swap.va)){
+          // megapages stay in memory.
+          swap.va += MEGAPGSIZE - PGSIZE;
+          continue;
+        }
+        if((pte = walk(p->pagetable, swap.va, 0)) == 0 || !swappable(*pte))
+          continue;
+        if(*pte & PTE_A){
+          *pte &= ~PTE_A;   // second chance
+          continue;
+        }
+        pa = (void*)PTE2PA(*pte);
+        if((slot = slotalloc(pa)) < 0)
+          break;
+        *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+        if(p == myproc()){
+          // this hart may cache the page under p's ASID, and
+          // under ASID 0 through the user window.
+          uvmflush(p->pagetable, swap.va);
+        } else {
+          // p isn't running. a fresh ASID drops whatever other
+          // harts cached for it; uvmwin() flushes the user
+          // window when p next runs.
+          p->asidgen = 0;
+        }
+        swap.va += PGSIZE;
+        break;
+      }
+      if(swap.va >= p->sz)
+        done = 1;
+    }
+    if(done){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.va = 0;
+    }
+    release(&p->lock);
+
+    if(slot < 0){
+      if(pa)
+        break;   // swap is full
+      continue;
+    }
+
+    // p can no longer reach pa; write it out unlocked.
+    virtio_disk_rwpage(SWAPSTART + slot * SLOTBLOCKS, pa, 1);
+    acquire(&swap.lock);
+    swap.page[slot] = 0;
+    swap.nout++;
+    release(&swap.lock);
+    kfree(pa);
+    freed++;
+  }
+  releasesleep(&swap.clock);
+  return freed;
+}
+
+// Print swap usage. For debugging.
+void
+swapdump(void)
+{
+  printf("swap: %d/%d slots out %ld in %ld full %ld\n",
+         swap.nused, NSLOT, swap.nout, swap.nin, swap.nfull);
+}
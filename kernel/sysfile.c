@@ -341,6 +341,13 @@ sys_open(void)
     return -1;
   }
 
+  // a running program can't be written; see kexec().
+  if(ip->type == T_FILE && (omode & (O_WRONLY|O_RDWR|O_TRUNC)) && ip->nexec > 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -359,6 +366,8 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  if(f->type == FD_INODE && f->writable)
+    __sync_fetch_and_add(&ip->nwrite, 1);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -431,8 +440,11 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the path and argv arguments of exec() and spawn(),
+// and pass them to fn. argv strings are copied into kalloc()ed
+// pages, freed again on return.
+static uint64
+execargs(int (*fn)(char*, char**))
 {
   char path[MAXPATH], *argv[MAXARG];
   int i;
@@ -461,7 +473,7 @@ sys_exec(void)
       goto bad;
   }
 
-  int ret = exec(path, argv);
+  int ret = fn(path, argv);
 
   for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
     kfree(argv[i]);
@@ -474,6 +486,76 @@ sys_exec(void)
   return -1;
 }
 
+uint64
+sys_exec(void)
+{
+  return execargs(exec);
+}
+
+uint64
+sys_spawn(void)
+{
+  return execargs(spawn);
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  if(addr != 0 || off < 0)
+    return -1;   // mmap() picks the address
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_shmcreate(void)
+{
+  uint64 size;
+  struct file *f;
+  int fd;
+
+  argaddr(0, &size);
+  if(shmalloc(&f, size) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_madvise(void)
+{
+  uint64 addr, len;
+  int advice;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &advice);
+  return madvise(addr, len, advice);
+}
+
 uint64
 sys_pipe(void)
 {
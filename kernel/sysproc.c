@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kstat.h"
+#include "rusage.h"
 
 uint64
 sys_exit(void)
@@ -91,3 +93,39 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy kernel statistics to the struct kstat at
+// the user address in argument 0.
+uint64
+sys_kstat(void)
+{
+  struct kstat ks;
+  struct proc *p = myproc();
+  uint64 addr;
+
+  argaddr(0, &addr);
+  memset(&ks, 0, sizeof(ks));
+  kallocstat(&ks);
+  procstat(&ks);
+  if(copyout(p->pagetable, addr, (char*)&ks, sizeof(ks)) < 0)
+    return -1;
+  return 0;
+}
+
+// copy the calling process's resource usage to the
+// struct rusage at the user address in argument 0.
+uint64
+sys_getrusage(void)
+{
+  struct rusage ru;
+  struct proc *p = myproc();
+  uint64 addr;
+
+  argaddr(0, &addr);
+  memset(&ru, 0, sizeof(ru));
+  ru.nfault = p->nfault;
+  ru.nfaultpages = p->nfaultpages;
+  if(copyout(p->pagetable, addr, (char*)&ru, sizeof(ru)) < 0)
+    return -1;
+  return 0;
+}
@@ -16,6 +16,14 @@ void kernelvec();
 
 extern int devintr();
 
+// loads and stores in uaccess.S that may fault,
+// and where to go if they do.
+struct exentry {
+  uint64 insn;
+  uint64 fixup;
+};
+extern struct exentry extable[], extable_end[];
+
 void
 trapinit(void)
 {
@@ -29,6 +37,40 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+//
+// A load or store of user memory through the user window faulted.
+// Bring the page in as for a fault in user space, or else go on
+// at the copy's fixup code. Returns the pc to resume at.
+// kerneltrap() has cleared SSTATUS.SUM, since vmfault() may sleep.
+// Copy-on-write pages are copied even if the copy will overwrite
+// them; copyout() breaks those ahead of time.
+//
+static uint64
+uaccessfault(uint64 sepc, uint64 stval, int write)
+{
+  struct exentry *e;
+  pagetable_t pagetable;
+  uint64 va;
+
+  for(e = extable; e < extable_end; e++)
+    if(e->insn == sepc)
+      break;
+  if(e == extable_end || myproc() == 0 ||
+     stval < USERWIN || stval >= USERWIN + USERWINSIZE){
+    printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", r_scause(), sepc, stval);
+    panic("kerneltrap: user access");
+  }
+
+  pagetable = myproc()->pagetable;
+  va = stval - USERWIN;
+  if(vmfault(pagetable, va, write) == 0 ||
+     (write && cow_fault(pagetable, va, 0) == 0)){
+    sfence_vma_page(stval, 0);
+    return sepc;   // try again
+  }
+  return e->fixup;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -67,57 +109,19 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
-  } else if(r_scause() == 0xf) // store page fault
-  {
-    uint64 va = r_stval();
-    pagetable_t pt = p->pagetable;
-    if(va >= MAXVA){
-      printf("usertrap(): va=%p\n", (void *)va);
-      printf("            sepc=%p\n", (void*)r_sepc());
-      setkilled(p);
-      goto exit;
-    }
-    pte_t *pte = walk(pt, va, 0);
-    if(!pte){
-      printf("usertrap(): pte is null\n");
-      printf("            va=%p\n", (void *)va);
-      printf("            sepc=%p\n", (void*)r_sepc());
-      setkilled(p);
-      goto exit;
-    }
-    if(*pte & PTE_COW && *pte & PTE_U && *pte & PTE_V){ // copy on write
-
-      *pte &= ~PTE_COW; // change to not cow
-      *pte |= PTE_W; // change to writable
-
-      uint64 pa = PTE2PA(*pte);
-
-      int flags = PTE_FLAGS(*pte);
-      
-      char *mem = kalloc();
-      if(mem == 0){
-        printf("usertrap(): out of memory\n");
-        setkilled(p);
-        return;
-      }
-      
-      memmove(mem, (char*)pa, PGSIZE);
-      *pte = PA2PTE((uint64)mem) | flags;
-      kfree((void*)pa);
-      sfence_vma();
-    }
-    else{
-      printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
-      printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
-      setkilled(p);
-    }
+  } else if((r_scause() == 0xc || r_scause() == 0xd) &&
+            vmfault(p->pagetable, r_stval(), 0) == 0){
+    // fetch or load from lazily allocated or swapped-out memory.
+  } else if(r_scause() == 0xf &&
+            (vmfault(p->pagetable, r_stval(), 1) == 0 ||
+             cow_fault(p->pagetable, r_stval(), 0) == 0)){
+    // store to lazily allocated, swapped-out or copy-on-write memory.
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
     setkilled(p);
   }
 
-  exit:
   if(killed(p))
     exit(-1);
 
@@ -164,8 +168,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with the process's ASID.
+  uint64 satp = MAKE_SATP_ASID(p->pagetable, uvmasid(p));
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -189,15 +194,28 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // don't let whatever runs if this trap sleeps or yields
+  // use an interrupted copy's access to user memory.
+  // the w_sstatus() below turns it back on.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) && (sstatus & SSTATUS_SUM)){
+    // a copy to or from user memory faulted.
+    sepc = uaccessfault(sepc, r_stval(), scause == 15);
+  } else if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
+  if(which_dev == 2 && myproc() != 0){
+    // the interrupted kernel code may be holding a
+    // physical address from the user page table.
+    myproc()->kpreempted = 1;
     yield();
+    myproc()->kpreempted = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -205,6 +223,13 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// interrupt hart, to bring it out of wfi in scheduler().
+void
+ipi(int hart)
+{
+  *(volatile uint32*)CLINT_MSIP(hart) = 1;
+}
+
 void
 clockintr()
 {
@@ -251,6 +276,11 @@ devintr()
     if(irq)
       plic_complete(irq);
 
+    return 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt from another hart's ipi(), which
+    // ipivec passed on. it only wakes the hart from wfi.
+    w_sip(r_sip() & ~2);
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
@@ -3,8 +3,15 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "page.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
+
+// pages to push out to swap when user memory runs out.
+#define NRECLAIM 32
 
 /*
  * the kernel's page table.
@@ -15,14 +22,87 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int ptunshare(pte_t *);
+static void ptput(uint64);
+static int cowbreak(pte_t *, int, int);
+
+// a page of zeros, mapped read-only and copy-on-write
+// wherever user memory is grown without data.
+static char *zeropage;
+
+// user megapages. a megapage mapping holds a reference to
+// each of its 4 KB pages, so that splitting one up leaves
+// every page's refcnt right.
+static struct {
+  int mapped;      // megapage PTEs in user page tables
+  uint64 nalloc;   // megapages allocated by vmfault()
+  uint64 nsplit;   // megapages broken into 4 KB PTEs
+} mega;
+
+// copy-on-write faults, by how they were resolved.
+static struct {
+  uint64 ncopy;      // copied the shared page
+  uint64 nreuse;     // the faulting process had the page to itself
+  uint64 nzero;      // the shared page was the zero page
+  uint64 noverwrite; // copyout() was about to fill the whole page
+} cow;
+
+// level-0 page-table pages shared between processes since
+// fork(). the level-1 PTE of each sharer is invalid, with PTE_COW
+// set and the page-table page's address. on the first touch of
+// any address under it, a sharer either takes the page-table page
+// back for itself, if no one else is left, or makes a private copy
+// that shares the pages it maps copy-on-write. hardware ignores
+// the permission bits of non-leaf PTEs, so a shared page-table
+// page can't be left valid for loads only.
+// ptshare.lock serializes copying a shared page-table page with
+// the other sharers' copying and freeing of it.
+static struct {
+  struct spinlock lock;
+  uint64 nshare;     // page-table pages shared by fork()
+  uint64 ncopy;      // ... later copied by a sharer
+  uint64 nreuse;     // ... later taken back by the last sharer
+} ptshare;
+
+// address spaces of exited processes, waiting to be freed.
+// uvmfreelater() queues them, so that wait() and exec() needn't
+// take time in proportion to the memory freed; idle harts free
+// them 2 MB at a time in uvmreap(), as does uvmkalloc() if
+// memory runs short first.
+struct reap {
+  pagetable_t pagetable;
+  uint64 va;         // user memory below va is freed
+  uint64 sz;
+  struct reap *next;
+};
+static struct {
+  struct spinlock lock;
+  struct reap *head;
+  int n;             // address spaces queued
+  uint64 nqueued;    // ... ever
+  uint64 nchunks;    // 2 MB pieces freed by uvmreap()
+} reap;
+
+// address-space IDs tag each process's TLB entries, so that
+// switching page tables needn't flush the TLB. ASIDs are handed
+// out in order. when they run out a new generation starts, and
+// each hart flushes its whole TLB before it next runs a process.
+// a process whose page table changed in a way another hart might
+// have cached simply gets a new ASID. ASID 0 is the kernel's.
+static struct {
+  struct spinlock lock;
+  uint64 gen;      // current generation, from 1
+  int next;        // next free ASID in this generation
+  int max;         // largest ASID to use, at most NASID; 0 if none
+} asids;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -30,6 +110,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for ipi()
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
@@ -37,6 +120,8 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // beyond the first 2 MB boundary after etext this is
+  // all megapages.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -54,6 +139,13 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
+  pgsetflags(PA2PG(zeropage), PG_PINNED | PG_ZERO);
+
+  initlock(&ptshare.lock, "ptshare");
+  initlock(&reap.lock, "reap");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,18 +153,142 @@ kvminit(void)
 void
 kvminithart()
 {
+  struct cpu *c = mycpu();
+  uint64 max;
+
+  // each hart gets its own top-level page table, sharing the
+  // rest of kernel_pagetable, for its user window.
+  if((c->pagetable = kalloc()) == 0)
+    panic("kvminithart");
+  memmove(c->pagetable, kernel_pagetable, PGSIZE);
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  // find out how many ASID bits there are: they read back
+  // as ones if they are implemented.
+  w_satp(MAKE_SATP(c->pagetable) | SATP_ASID_MASK);
+  max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  w_satp(MAKE_SATP(c->pagetable));
+  if(max > NASID)
+    max = NASID;
 
   // flush stale entries from the TLB.
   sfence_vma();
+
+  if(cpuid() == 0){
+    initlock(&asids.lock, "asids");
+    asids.gen = 1;
+    asids.next = 1;
+    asids.max = max;
+  }
+}
+
+// Return the ASID to run p's page table with on this hart,
+// giving p a new one if it has none from this generation.
+// Flushes this hart's TLB if it's from an older generation.
+// Called with interrupts off, from usertrapret().
+int
+uvmasid(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen;
+
+  if(asids.max == 0){
+    // no ASIDs; trampoline.S flushes on every switch.
+    return 0;
+  }
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if(p->asidgen != gen){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      __atomic_store_n(&asids.gen, asids.gen + 1, __ATOMIC_RELEASE);
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = gen = asids.gen;
+    p->asidharts = 0;
+    release(&asids.lock);
+    // orders earlier stores to the page table before
+    // the hardware walks it; there are no entries yet.
+    sfence_vma_asid(p->asid);
+  }
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  }
+  p->asidharts |= 1L << cpuid();
+  return p->asid;
+}
+
+// PTEs for va in pagetable, or all of them if va is -1, were
+// changed or removed. If it's the current process's page table,
+// make sure no hart goes on using the old translations: flush
+// them here if no other hart can have them, or else give the
+// process a new ASID. Other page tables aren't in use.
+void
+uvmflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || pagetable != p->pagetable)
+    return;
+  push_off();
+  if(va == -1)
+    sfence_vma_asid(0);   // the kernel's user window
+  else
+    sfence_vma_page(USERWIN + va, 0);
+  if(p->asidharts & ~(1L << cpuid()))
+    p->asidgen = 0;
+  else if(va == -1)
+    sfence_vma_asid(p->asid);
+  else
+    sfence_vma_page(va, p->asid);
+  pop_off();
+}
+
+// Point this hart's user window at p's memory, as the kernel
+// is about to run for p. p's page table may have changed since
+// this hart last ran it, so drop the window's TLB entries.
+// SSTATUS.SUM should already be clear (see kerneltrap());
+// make sure.
+void
+uvmwin(struct proc *p)
+{
+  push_off();
+  mycpu()->pagetable[PX(2, USERWIN)] = p->pagetable ? p->pagetable[0] : 0;
+  sfence_vma_asid(0);
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  pop_off();
+}
+
+// Can the kernel reach [va, va+len) of pagetable through the
+// user window? Only if it's the current process's. Not if the
+// range includes the stack guard page, either: its PTE lacks
+// only PTE_U, which doesn't stop the kernel, so copies that
+// touch it must take the slow path, which checks PTE_U.
+static int
+uvmwinok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  int ok;
+
+  if(p == 0 || pagetable != p->pagetable ||
+     va + len < va || va + len > USERWINSIZE)
+    return 0;
+  if(p->stackguard && va < p->stackguard + PGSIZE && va + len > p->stackguard)
+    return 0;
+  push_off();
+  ok = (pagetable[0] & PTE_V) && mycpu()->pagetable[PX(2, USERWIN)] == pagetable[0];
+  pop_off();
+  return ok;
 }
 
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
+// If va lies in a superpage, return the superpage's PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -84,22 +300,37 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but return the PTE at the given level,
+// 0 for a 4 KB page up to 2 for a gigapage.
+// With alloc set, a page-table page shared since fork()
+// is unshared on the way.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;   // superpage
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else if(*pte & PTE_COW) {
+      if(!alloc || ptunshare(pte) < 0)
+        return 0;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -114,6 +345,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if(va >= MAXVA)
     return 0;
 
+  if((pte = megapte(pagetable, va)) != 0){
+    if((*pte & PTE_U) == 0)
+      return 0;
+    return PTE2PA(*pte) + (PGROUNDDOWN(va) & (MEGAPGSIZE - 1));
+  }
+
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     return 0;
@@ -125,6 +362,167 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// If va lies in a megapage, return its PTE, else 0.
+pte_t *
+megapte(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, 0, 1);
+  if(pte == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  return pte;
+}
+
+// Take another reference to what the user PTE at pte maps,
+// making a writable page copy-on-write, unless it's a file page
+// or shared-memory page mapped MAP_SHARED. Returns the PTE for the new reference.
+// Caller holds ptshare.lock.
+static pte_t
+ptecopy(pte_t *pte)
+{
+  uint64 pa;
+
+  if(*pte & PTE_SWAP){
+    swapdup(PTE2SLOT(*pte));
+  } else if(*pte & PTE_V){
+    pa = PTE2PA(*pte);
+    kdup((void*)pa);
+    if((*pte & PTE_W) && (PA2PG(pa)->flags & (PG_FILE|PG_SHARED)))
+      return *pte;   // a MAP_SHARED page; see mmap.c
+    if(*pte & (PTE_W|PTE_COW)){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      pgsetflags(PA2PG(pa), PG_COW);
+    }
+  }
+  return *pte;
+}
+
+// Make the level-1 PTE at l1pte, which names a page-table page
+// shared since fork(), valid again, with a page-table page of
+// its own. Returns 0, or -1 if out of memory.
+static int
+ptunshare(pte_t *l1pte)
+{
+  pagetable_t pt, npt;
+  int i;
+
+  // allocate first, since it may sleep.
+  if((npt = (pagetable_t)uvmkalloc(0)) == 0)
+    return -1;
+  pt = (pagetable_t)PTE2PA(*l1pte);
+  acquire(&ptshare.lock);
+  if(krefcnt(pt) == 1){
+    // the other sharers are gone.
+    release(&ptshare.lock);
+    kfree(npt);
+    *l1pte = PA2PTE(pt) | PTE_V;
+    __sync_fetch_and_add(&ptshare.nreuse, 1);
+    return 0;
+  }
+  for(i = 0; i < 512; i++)
+    npt[i] = ptecopy(&pt[i]);
+  kfree(pt);   // our reference; others remain
+  release(&ptshare.lock);
+  *l1pte = PA2PTE(npt) | PTE_V;
+  __sync_fetch_and_add(&ptshare.ncopy, 1);
+  return 0;
+}
+
+// Does the page-table page pt map nothing from index i on?
+static int
+ptempty(pagetable_t pt, int i)
+{
+  for(; i < 512; i++)
+    if(pt[i])
+      return 0;
+  return 1;
+}
+
+// Drop a reference to the shared page-table page pt, freeing
+// it and what it maps if it was the last one.
+static void
+ptput(uint64 pt)
+{
+  pte_t pte;
+  int i;
+
+  acquire(&ptshare.lock);
+  if(krefcnt((void*)pt) > 1){
+    kfree((void*)pt);
+    release(&ptshare.lock);
+    return;
+  }
+  release(&ptshare.lock);
+
+  for(i = 0; i < 512; i++){
+    pte = ((pagetable_t)pt)[i];
+    if(pte & PTE_SWAP)
+      swapfree(PTE2SLOT(pte));
+    else if(pte & PTE_V)
+      kfree((void*)PTE2PA(pte));
+  }
+  kfree((void*)pt);
+}
+
+// Drop a reference to each page of the user megapage at pa.
+static void
+megafree(uint64 pa)
+{
+  int i;
+
+  for(i = 0; i < 512; i++)
+    if(krefcnt((void*)(pa + i*PGSIZE)) != 1)
+      break;
+  if(i == 512){
+    // ours alone: give the block back whole.
+    kfree_pages((void*)pa, MEGAORDER);
+    return;
+  }
+  for(i = 0; i < 512; i++)
+    kfree((void*)(pa + i*PGSIZE));
+}
+
+// Break the megapage containing va, if there is one, into
+// 4 KB PTEs with the same permissions.
+// Returns 0, or -1 if out of memory for the page-table page.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 pa;
+  int i;
+
+  if(megapte(pagetable, va) == 0)
+    return 0;
+  if((l0 = (pagetable_t)uvmkalloc(0)) == 0)
+    return -1;
+  pte = megapte(pagetable, va);  // uvmkalloc() may have slept
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  __sync_fetch_and_sub(&mega.mapped, 1);
+  __sync_fetch_and_add(&mega.nsplit, 1);
+  uvmflush(pagetable, va & ~(MEGAPGSIZE - 1));
+  return 0;
+}
+
+// The largest level at which a leaf can map va to pa with
+// size bytes left to map.
+static int
+leaflevel(uint64 va, uint64 pa, uint64 size)
+{
+  int level;
+
+  for(level = 2; level > 0; level--){
+    if(((va | pa) & (LEVELSIZE(level) - 1)) == 0 && size >= LEVELSIZE(level))
+      break;
+  }
+  return level;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -138,13 +536,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Uses megapages and gigapages wherever va, pa and the
+// remaining size are aligned enough.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -155,24 +556,20 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   if(size == 0)
     panic("mappages: size");
   
-  a = va;
-  last = va + size - PGSIZE;
-  for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+  end = va + size;
+  for(a = va; a < end; a += LEVELSIZE(level), pa += LEVELSIZE(level)){
+    level = leaflevel(a, pa, end - a);
+    if((pte = walklevel(pagetable, a, 1, level)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
-      break;
-    a += PGSIZE;
-    pa += PGSIZE;
   }
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -184,10 +581,44 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walklevel(pagetable, a, 0, 1)) != 0 &&
+       (*pte & (PTE_V|PTE_COW)) == PTE_COW){
+      // a page-table page shared since fork(). drop it whole
+      // if nothing of it outlives the unmap, as at exit().
+      if(do_free && a % MEGAPGSIZE == 0 &&
+         (a + MEGAPGSIZE <= va + npages*PGSIZE ||
+          ptempty((pagetable_t)PTE2PA(*pte), PX(0, va + npages*PGSIZE)))){
+        ptput(PTE2PA(*pte));
+        *pte = 0;
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(walk(pagetable, a, 1) == 0)
+        panic("uvmunmap: unshare");
+    }
+    if((pte = megapte(pagetable, a)) != 0){
+      if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= va + npages*PGSIZE){
+        if(do_free)
+          megafree(PTE2PA(*pte));
+        *pte = 0;
+        __sync_fetch_and_sub(&mega.mapped, 1);
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      // unmapping part of it.
+      if(uvmsplit(pagetable, a) < 0)
+        panic("uvmunmap: split");
+    }
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;   // lazily grown, never touched
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -196,6 +627,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  uvmflush(pagetable, npages == 1 ? va : -1);
 }
 
 // create an empty user page table.
@@ -204,10 +636,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,8 +652,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -240,12 +670,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = uvmkalloc(1);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -255,6 +684,392 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Grow process from oldsz to newsz, which need not be page
+// aligned, by mapping every new page to the shared zero page.
+// Writable pages are mapped copy-on-write, so a private page is
+// only allocated on the first store. Returns new size or 0 on error.
+uint64
+uvmmapzero(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
+{
+  uint64 a;
+  int perm;
+
+  if(newsz < oldsz)
+    return oldsz;
+
+  perm = PTE_R|PTE_U|xperm;
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+
+  oldsz = PGROUNDUP(oldsz);
+  for(a = oldsz; a < newsz; a += PGSIZE){
+    if(mappages(pagetable, a, PGSIZE, (uint64)zeropage, perm) != 0){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
+    }
+  }
+  return newsz;
+}
+
+// Allocate a page of user memory, zeroed if zero is set.
+// If memory is short, push other user pages out to swap,
+// unless the caller holds a spinlock and so cannot wait.
+// Returns 0 if memory is really gone.
+char*
+uvmkalloc(int zero)
+{
+  char *mem;
+
+  for(;;){
+    mem = zero ? kalloc_zeroed() : kalloc();
+    if(mem || myproc() == 0 || holdingany())
+      return mem;
+    // memory of exited processes goes first, then unmapped file
+    // pages, which needn't be written out.
+    if(uvmreap() == 0 && pcachereclaim(NRECLAIM) == 0 &&
+       swapreclaim(NRECLAIM) == 0)
+      return 0;
+  }
+}
+
+// Map a fresh zeroed megapage over the 2 MB of user memory
+// around va, if all of it is below sz and none of it has been
+// touched yet. Returns 0 if it did.
+static int
+megaalloc(pagetable_t pagetable, uint64 va, uint64 sz)
+{
+  uint64 base = va & ~(MEGAPGSIZE - 1);
+  pte_t *pte;
+  char *mem;
+
+  if(base + MEGAPGSIZE > sz)
+    return -1;
+  if((pte = walklevel(pagetable, base, 1, 1)) == 0 || *pte != 0)
+    return -1;
+  if((mem = kalloc_pages(MEGAORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGAPGSIZE);
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  __sync_fetch_and_add(&mega.mapped, 1);
+  __sync_fetch_and_add(&mega.nalloc, 1);
+  return 0;
+}
+
+// Fault-around. A process that faults on one page after another,
+// as when it first fills a big array, or when a fork() child writes
+// memory it shares with its parent, gets the pages around the one
+// that faulted handled in the same fault: a window, aligned to its
+// size, that doubles with each fault in the sequence up to
+// FAULTAROUND pages. Returns the window's start and sets *end.
+static uint64
+faultwindow(struct proc *p, uint64 va, uint64 *end)
+{
+  uint64 start;
+
+  if(va != p->faultnext || p->faultwin == 0)
+    p->faultwin = 1;
+  else if(p->faultwin < FAULTAROUND)
+    p->faultwin *= 2;
+  start = va & ~((uint64)p->faultwin * PGSIZE - 1);
+  *end = start + (uint64)p->faultwin * PGSIZE;
+  if(*end > PGROUNDUP(p->sz))
+    *end = PGROUNDUP(p->sz);
+  p->faultnext = *end;
+  p->nfault++;
+  return start;
+}
+
+// PTE permissions for the pages of the mapping v. A private
+// writable mapping's pages start out copy-on-write.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE)
+    perm |= v->flags == MAP_SHARED ? PTE_W : PTE_COW;
+  return perm;
+}
+
+// Map the page of v's file for va at pte, which is empty.
+// See mmap.c. Returns 0, or -1 if the access isn't allowed,
+// va is past the end of the file, or memory ran out.
+static int
+mmapfill(struct vma *v, pte_t *pte, uint64 va, int write)
+{
+  char *pa;
+
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if(holdingany() || (pa = mmappage(v, va)) == 0)
+    return -1;
+  *pte = PA2PTE(pa) | vmaperm(v) | PTE_V;
+  if(*pte & PTE_COW){
+    pgsetflags(PA2PG(pa), PG_COW);
+    if(write)
+      return cowbreak(pte, 0, 1);
+  }
+  return 0;
+}
+
+// Map all of v's pages now, rather than as they're touched.
+// Returns 0, or -1 if memory ran out, leaving what was
+// mapped for the caller to unmap.
+int
+uvmmapvma(pagetable_t pagetable, struct vma *v)
+{
+  uint64 a;
+  char *pa;
+
+  for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+    if((pa = mmappage(v, a)) == 0)
+      return -1;
+    if(mappages(pagetable, a, PGSIZE, (uint64)pa, vmaperm(v) & ~PTE_COW) != 0){
+      kfree(pa);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Map the page at va of segment s of the current process's
+// program at pte, which is empty. Returns 0, or -1 if the
+// access isn't allowed or the page can't be read in.
+static int
+execfill(struct execseg *s, pte_t *pte, uint64 va, int write)
+{
+  char *pa;
+
+  if(write && (s->perm & PTE_W) == 0)
+    return -1;
+  if(holdingany() || (pa = execpage(myproc(), s, va)) == 0)
+    return -1;
+  *pte = PA2PTE(pa) | s->perm | PTE_R | PTE_U | PTE_V;
+  if((*pte & PTE_W) && (PA2PG(pa)->flags & PG_FILE)){
+    // the page cache's; a store gets a private copy.
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    pgsetflags(PA2PG(pa), PG_COW);
+    if(write)
+      return cowbreak(pte, 0, 1);
+  }
+  return 0;
+}
+
+// Handle a page fault at va in pagetable, which must be the
+// current process's, for a page that sbrk() grew lazily, that
+// exec() left for the program file to fill, or that was
+// swapped out. A load from a lazy page maps the
+// shared zero page; a store gets a private zeroed page, or a
+// whole megapage if the 2 MB around it are all untouched.
+// Untouched pages around va may be mapped along with it; see
+// faultwindow().
+// Returns 0 if a page was mapped, or -1 if va is neither,
+// memory ran out, or the caller holds a spinlock and so
+// cannot wait for the disk.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v = 0;
+  struct execseg *s;
+  uint64 a, start, end;
+  pte_t *pte;
+  char *mem;
+  int n;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  if(va >= p->sz && (v = mmapvma(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if(v == 0 && write && execseg(p, va & ~(MEGAPGSIZE - 1), MEGAPGSIZE) == 0 &&
+     megaalloc(pagetable, va, p->sz) == 0){
+    p->nfault++;
+    p->nfaultpages += MEGAPGSIZE / PGSIZE;
+    goto mapped;
+  }
+  if((pte = walk(pagetable, va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_V){
+    // mapped already, maybe by unsharing its page-table page.
+    // the stack guard page and copy-on-write pages are not
+    // for vmfault() to handle.
+    if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+      return -1;
+    goto mapped;
+  }
+
+  if(*pte & PTE_SWAP){
+    if(holdingany() || (mem = uvmkalloc(0)) == 0)
+      return -1;
+    swapin(PTE2SLOT(*pte), mem);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+    p->nfault++;
+    p->nfaultpages++;
+    goto mapped;
+  }
+  if(v){
+    if(mmapfill(v, pte, va, write) < 0)
+      return -1;
+    p->nfault++;
+    p->nfaultpages++;
+    goto mapped;
+  }
+  if((s = execseg(p, va, PGSIZE)) != 0){
+    if(execfill(s, pte, va, write) < 0)
+      return -1;
+    p->nfault++;
+    p->nfaultpages++;
+    goto mapped;
+  }
+  if(write){
+    if((mem = uvmkalloc(1)) == 0)
+      return -1;
+    *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  } else {
+    *pte = PA2PTE(zeropage) | PTE_R | PTE_U | PTE_COW | PTE_V;
+  }
+
+  // map the untouched pages around va the same way,
+  // as far as memory allows without reclaiming.
+  n = 1;
+  start = faultwindow(p, va, &end);
+  for(a = start; a < end; a += PGSIZE){
+    if(a == va || (pte = walk(pagetable, a, 0)) == 0 || *pte != 0 ||
+       execseg(p, a, PGSIZE))
+      continue;
+    if(write){
+      if((mem = kalloc_zeroed()) == 0)
+        break;
+      *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+    } else {
+      *pte = PA2PTE(zeropage) | PTE_R | PTE_U | PTE_COW | PTE_V;
+    }
+    sfence_vma_page(a, p->asid);
+    n++;
+  }
+  p->nfaultpages += n;
+
+ mapped:
+  // this hart may have cached the invalid PTE.
+  sfence_vma_page(va, p->asid);
+  return 0;
+}
+
+// Give the copy-on-write page at pte a private, writable page.
+// Set overwrite if the caller is about to fill the whole page,
+// so the old contents needn't be copied. Set reclaim if the
+// page is needed, rather than wanted, to make room for it by
+// swapping. Returns 0, or -1 if it isn't copy-on-write or
+// memory ran out.
+static int
+cowbreak(pte_t *pte, int overwrite, int reclaim)
+{
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int zero;
+
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if((PA2PG(pa)->flags & PG_PINNED) == 0 && krefcnt((void*)pa) == 1){
+    // the other sharers are gone; no one else can
+    // take a new reference, so just make it writable.
+    *pte = PA2PTE(pa) | flags;
+    __sync_fetch_and_add(&cow.nreuse, 1);
+    return 0;
+  }
+
+  zero = (PA2PG(pa)->flags & PG_ZERO) != 0;
+  if(reclaim)
+    mem = uvmkalloc(zero && !overwrite);
+  else
+    mem = zero ? kalloc_zeroed() : kalloc();
+  if(mem == 0)
+    return -1;
+  if(overwrite)
+    __sync_fetch_and_add(&cow.noverwrite, 1);
+  else if(zero)
+    __sync_fetch_and_add(&cow.nzero, 1);
+  else {
+    memmove(mem, (char*)pa, PGSIZE);
+    __sync_fetch_and_add(&cow.ncopy, 1);
+  }
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Give pagetable a private, writable page at va in place of a
+// copy-on-write one, and maybe some of its neighbors too; see
+// faultwindow(). Set overwrite if the caller is about to fill
+// the whole page, so the old contents needn't be copied.
+// Returns 0, or -1 if va isn't copy-on-write or memory ran out.
+int
+cow_fault(pagetable_t pagetable, uint64 va, int overwrite)
+{
+  struct proc *p = myproc();
+  uint64 a, start, end;
+  pte_t *pte;
+  int n;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA)
+    return -1;
+  if(uvmsplit(pagetable, va) < 0)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if(cowbreak(pte, overwrite, 1) < 0)
+    return -1;
+  uvmflush(pagetable, va);
+
+  if(p == 0 || pagetable != p->pagetable || va >= p->sz)
+    return 0;
+  n = 1;
+  start = faultwindow(p, va, &end);
+  for(a = start; a < end; a += PGSIZE){
+    if(a == va || (pte = walk(pagetable, a, 0)) == 0)
+      continue;
+    if(cowbreak(pte, 0, 0) == 0){
+      uvmflush(pagetable, a);
+      n++;
+    }
+  }
+  p->nfaultpages += n;
+  return 0;
+}
+
+// Fault in the pages of [va, end) that aren't mapped, as a load
+// would, or with write set, as a store would, so that they are
+// also private and writable. pagetable must be the current
+// process's. Returns 0, or -1 if a page can't be faulted in
+// that way or memory ran out.
+int
+uvmpopulate(pagetable_t pagetable, uint64 va, uint64 end, int write)
+{
+  uint64 a;
+  pte_t pte;
+
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    pte = uvmpte(pagetable, a);
+    if((pte & PTE_V) && (!write || (pte & PTE_W)))
+      continue;
+    if(vmfault(pagetable, a, write) == 0)
+      continue;
+    if(!write || cow_fault(pagetable, a, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -303,45 +1118,145 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Like uvmfree(), but leave the work to uvmreap(). The page
+// table must no longer be in use, and must map nothing above sz.
+void
+uvmfreelater(pagetable_t pagetable, uint64 sz)
+{
+  struct reap *r;
+
+  if((r = kmalloc(sizeof(*r))) == 0){
+    uvmfree(pagetable, sz);
+    return;
+  }
+  r->pagetable = pagetable;
+  r->va = 0;
+  r->sz = PGROUNDUP(sz);
+  acquire(&reap.lock);
+  r->next = reap.head;
+  reap.head = r;
+  reap.n++;
+  reap.nqueued++;
+  release(&reap.lock);
+}
+
+// Free the next 2 MB of the address spaces queued by
+// uvmfreelater(), and the page table once they're all gone.
+// Returns 0 if there was nothing to free.
+// Must not be called with spinlocks held.
+int
+uvmreap(void)
+{
+  struct reap *r;
+  uint64 n;
+
+  acquire(&reap.lock);
+  if((r = reap.head) != 0){
+    // take it off the queue while freeing, so
+    // that no other hart works on it too.
+    reap.head = r->next;
+    reap.n--;
+  }
+  release(&reap.lock);
+  if(r == 0)
+    return 0;
+
+  if(r->va < r->sz){
+    n = r->sz - r->va;
+    if(n > MEGAPGSIZE)
+      n = MEGAPGSIZE;
+    uvmunmap(r->pagetable, r->va, n / PGSIZE, 1);
+    r->va += n;
+    __sync_fetch_and_add(&reap.nchunks, 1);
+  }
+  if(r->va >= r->sz){
+    freewalk(r->pagetable);
+    kmfree(r);
+    return 1;
+  }
+  acquire(&reap.lock);
+  r->next = reap.head;
+  reap.head = r;
+  reap.n++;
+  release(&reap.lock);
+  return 1;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Rather than copying PTEs, the child shares each of the
+// parent's level-0 page-table pages, and each megapage,
+// copy-on-write; see ptunshare().
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  // char *mem;
+  return uvmcopyrange(old, new, 0, sz);
+}
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    add_ref((void*)pa);
-    flags = PTE_FLAGS(*pte);
-    // 写时复制
-    if(flags & PTE_W || flags & PTE_COW){
-    flags = (flags & ~PTE_W) | PTE_COW;
-    *pte = (*pte & ~PTE_W) | PTE_COW;
-    sfence_vma();
-    }
-    if(mappages(new, i, PGSIZE, (uint64)pa, flags) != 0){
+// Like uvmcopy(), for the memory from va to end.
+// Sharing goes by 2 MB; parts of the range's first and
+// last 2 MB that new already has are left alone.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 end)
+{
+  pte_t *pte, *npte;
+  uint64 pa, i, start;
+  int j;
+
+  start = va & ~(MEGAPGSIZE - 1);
+  for(i = start; i < end; i += MEGAPGSIZE){
+    if((pte = walklevel(old, i, 0, 1)) == 0 || *pte == 0)
+      continue;   // lazily grown, never touched
+    if((npte = walklevel(new, i, 1, 1)) == 0)
       goto err;
+    if(*npte != 0)
+      continue;   // shared by an earlier call
+    pa = PTE2PA(*pte);
+    if(*pte & PTE_V && PTE_LEAF(*pte)){
+      // share the whole megapage copy-on-write.
+      for(j = 0; j < 512; j++)
+        kdup((void*)(pa + j*PGSIZE));
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      __sync_fetch_and_add(&mega.mapped, 1);
+    } else {
+      // share the page-table page.
+      kdup((void*)pa);
+      *pte = PA2PTE(pa) | PTE_COW;
+      __sync_fetch_and_add(&ptshare.nshare, 1);
     }
+    *npte = *pte;
   }
+  // the parent's PTEs became copy-on-write or invalid.
+  uvmflush(old, -1);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmflush(old, -1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Return the PTE for va in pagetable, looking into page-table
+// pages shared since fork(), or 0 if there is none.
+pte_t
+uvmpte(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if((pte = walklevel(pagetable, va, 0, 1)) == 0)
+    return 0;
+  if(*pte & PTE_V){
+    if(PTE_LEAF(*pte))
+      return *pte;   // megapage
+  } else if((*pte & PTE_COW) == 0){
+    return 0;
+  }
+  return ((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -355,6 +1270,26 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Give pagetable private pages in place of the copy-on-write
+// pages wholly inside [va, va+len), without copying them, as
+// the caller is about to overwrite them. Failures are left for
+// the copy's faults to find.
+static void
+cowoverwrite(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = PGROUNDUP(va); a + PGSIZE <= va + len; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0){
+      vmfault(pagetable, a, 1);   // may unshare a page-table page
+      pte = walk(pagetable, a, 0);
+    }
+    if(pte && (*pte & PTE_COW))
+      cow_fault(pagetable, a, 1);
+  }
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -364,36 +1299,34 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   uint64 n, va0, pa0;
   pte_t *pte;
 
+  // faults are handled by kerneltrap(), which can't tell
+  // that the copy will overwrite the page, so break
+  // copy-on-write on whole pages here first.
+  if(uvmwinok(pagetable, dstva, len)){
+    if(len >= PGSIZE)
+      cowoverwrite(pagetable, dstva, len);
+    return uaccess_copy((void*)(USERWIN + dstva), src, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     if(va0 >= MAXVA)
       return -1;
     pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
-      return -1;
-    if((*pte & PTE_W) == 0){
-      if((*pte & PTE_COW) == 0){
+    if(pte == 0 || (*pte & PTE_V) == 0){
+      // vmfault() declines a page it leaves copy-on-write,
+      // as when it unshares a page-table page, so look again.
+      vmfault(pagetable, va0, 1);
+      pte = walk(pagetable, va0, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
         return -1;
-      }
-      // allocate a new page 
-      *pte &= ~PTE_COW; // change to not cow
-      *pte |= PTE_W; // change to writable
-
-      uint64 pa = PTE2PA(*pte);
-
-      int flags = PTE_FLAGS(*pte);
-      
-      char *mem = kalloc();
-      if(mem == 0){
-        panic("usertrap(): out of memory\n");
-      }
-      
-      memmove(mem, (char*)pa, PGSIZE);
-      *pte = PA2PTE((uint64)mem) | flags;
-      kfree((void*)pa);
-      sfence_vma();
     }
-    pa0 = PTE2PA(*pte);
+    if((*pte & PTE_U) == 0)
+      return -1;
+    if((*pte & PTE_W) == 0 &&
+       cow_fault(pagetable, va0, dstva == va0 && len >= PGSIZE) < 0)
+      return -1;
+    pa0 = walkaddr(pagetable, va0);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -414,11 +1347,17 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uvmwinok(pagetable, srcva, len))
+    return uaccess_copy(dst, (void*)(USERWIN + srcva), len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -441,11 +1380,17 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(uvmwinok(pagetable, srcva, max))
+    return uaccess_strcpy(dst, (char*)(USERWIN + srcva), max);
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -473,3 +1418,19 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     return -1;
   }
 }
+
+// Print how much user memory megapages map. For debugging.
+void
+vmdump(void)
+{
+  printf("vm: %d megapages mapped (%d MB) alloc %ld split %ld\n",
+         mega.mapped, mega.mapped * (int)(MEGAPGSIZE >> 20),
+         mega.nalloc, mega.nsplit);
+  printf("cow: copy %ld reuse %ld zero %ld overwrite %ld\n",
+         cow.ncopy, cow.nreuse, cow.nzero, cow.noverwrite);
+  printf("asid: generation %ld, %d a generation\n", asids.gen, asids.max);
+  printf("pt: shared %ld copied %ld reused %ld\n",
+         ptshare.nshare, ptshare.ncopy, ptshare.nreuse);
+  printf("reap: %d queued, %ld ever, %ld chunks freed\n",
+         reap.n, reap.nqueued, reap.nchunks);
+}
@@ -110,6 +110,10 @@ main(int argc, char *argv[])
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
 
+  // the swap area follows the file system; writing its last
+  // block is enough to make the image that big.
+  wsect(FSSIZE + SWAPSIZE - 1, zeroes);
+
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
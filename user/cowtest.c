@@ -218,6 +218,61 @@ forkforktest()
   printf("ok\n");
 }
 
+//
+// page-table pages are shared at fork() until one side
+// touches them; check that each side still sees its own data.
+//
+void
+ptsharetest()
+{
+  printf("ptshare: ");
+
+  int sz = 3 * 1024 * 1024;
+  char *p = sbrk(sz);
+  for(int i = 0; i < sz; i += 4096)
+    p[i] = i / 4096;
+
+  for(int nc = 0; nc < 2; nc++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      for(int i = 0; i < sz; i += 4096){
+        if(p[i] != (char)(i / 4096)){
+          printf("error: child sees wrong memory\n");
+          exit(-1);
+        }
+        if(nc == 0)
+          p[i] = 99;
+      }
+      exit(0);
+    }
+  }
+  // write before the second child has read.
+  p[sz - 4096] = 1;
+  for(int nc = 0; nc < 2; nc++){
+    int st;
+    wait(&st);
+    if(st != 0)
+      exit(-1);
+  }
+  p[sz - 4096] = (sz - 4096) / 4096;
+  for(int i = 0; i < sz; i += 4096){
+    if(p[i] != (char)(i / 4096)){
+      printf("error: parent's memory was modified!\n");
+      exit(1);
+    }
+  }
+  if(sbrk(-sz) == (char*)-1){
+    printf("sbrk(-%d) failed\n", sz);
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -234,6 +289,8 @@ main(int argc, char *argv[])
 
   forkforktest();
 
+  ptsharetest();
+
   printf("ALL COW TESTS PASSED\n");
 
   exit(0);
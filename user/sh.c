@@ -52,6 +52,8 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int simplecmd(char*);
+extern char whitespace[], symbols[];
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -146,6 +148,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct execcmd *ecmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -165,6 +168,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simplecmd(buf)){
+      // no need for a copy of the shell to exec() from.
+      ecmd = (struct execcmd*)parsecmd(buf);
+      if(ecmd->argv[0]){
+        if(spawn(ecmd->argv[0], ecmd->argv) < 0)
+          fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+        else
+          wait(0);
+      }
+      free(ecmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -172,6 +187,26 @@ main(void)
   exit(0);
 }
 
+// Is buf just a command and its arguments, without
+// redirection, pipes, lists, or background jobs?
+// Such a command parses without panic() and can be
+// run by spawn() from the shell itself.
+int
+simplecmd(char *buf)
+{
+  char *s;
+  int n;
+
+  n = 0;
+  for(s = buf; *s; s++){
+    if(strchr(symbols, *s))
+      return 0;
+    if(!strchr(whitespace, *s) && (s == buf || strchr(whitespace, s[-1])))
+      n++;
+  }
+  return n < MAXARGS;
+}
+
 void
 panic(char *s)
 {
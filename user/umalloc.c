@@ -2,6 +2,8 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -18,15 +20,20 @@ union header {
 
 typedef union header Header;
 
+// free() gives the pages of blocks at least this big back to
+// the kernel with madvise(); they come back zero when touched.
+#define TRIM (8*PGSIZE)
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Put block bp on the free list, merged with its neighbors.
+// Returns the free block that now holds it.
+static Header*
+insert(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -41,6 +48,31 @@ free(void *ap)
   } else
     p->s.ptr = bp;
   freep = p;
+  return p->s.ptr == bp ? bp : p;
+}
+
+void
+free(void *ap)
+{
+  Header *bp, *b;
+  uint64 start, end;
+
+  bp = (Header*)ap - 1;
+  start = PGROUNDDOWN((uint64)bp);
+  end = PGROUNDUP((uint64)(bp + bp->s.size));
+  if(bp->s.size * sizeof(Header) < TRIM){
+    insert(bp);
+    return;
+  }
+  // the whole pages of bp, and of the pages it shares with its
+  // neighbors the ones that are now free, but not the header.
+  b = insert(bp);
+  if(start < (uint64)(b + 1))
+    start = PGROUNDUP((uint64)(b + 1));
+  if(end > (uint64)(b + b->s.size))
+    end = PGROUNDDOWN((uint64)(b + b->s.size));
+  if(start < end)
+    madvise((void*)start, end - start, MADV_DONTNEED);
 }
 
 static Header*
@@ -56,7 +88,7 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  insert(hp);   // fresh from sbrk(); nothing to give back
   return freep;
 }
 
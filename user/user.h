@@ -1,4 +1,6 @@
 struct stat;
+struct kstat;
+struct rusage;
 
 // system calls
 int fork(void);
@@ -22,6 +24,13 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int spawn(const char*, char**);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int shmcreate(uint64);
+int madvise(void*, uint64, int);
+int kstat(struct kstat*);
+int getrusage(struct rusage*);
 
 // ulib.c
 int stat(const char*, struct stat*);
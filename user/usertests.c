@@ -1,6 +1,8 @@
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/kstat.h"
+#include "kernel/rusage.h"
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
@@ -110,8 +112,34 @@ copyout(char *s)
       printf("read(pipe, %p, 8192) returned %d, not -1 or 0\n", (void*)addr, n);
       exit(1);
     }
+    // the failed read mustn't have taken the data.
+    char c = 0;
+    if(read(fds[0], &c, 1) != 1 || c != 'x'){
+      printf("read(pipe, %p, 8192) lost the data\n", (void*)addr);
+      exit(1);
+    }
     close(fds[0]);
     close(fds[1]);
+
+    // nor a failed wait() the child.
+    if(addr == 0)
+      continue;
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(7);
+    if(wait((int*)addr) != -1){
+      printf("wait(%p) succeeded\n", (void*)addr);
+      exit(1);
+    }
+    int xstatus;
+    if(wait(&xstatus) != pid || xstatus != 7){
+      printf("wait(%p) lost the child\n", (void*)addr);
+      exit(1);
+    }
   }
 }
 
@@ -733,6 +761,234 @@ exectest(char *s)
 
 }
 
+// spawn() runs a program with the caller's open files,
+// and fails up front if it can't.
+void
+spawntest(char *s)
+{
+  int fd, pid, xstatus;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+
+  if(spawn("nonexistent", echoargv) >= 0){
+    printf("%s: spawn nonexistent succeeded\n", s);
+    exit(1);
+  }
+
+  unlink("spawn-ok");
+  fd = open("spawn-ok", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(1);
+  dup(fd);
+  pid = spawn("echo", echoargv);
+  close(1);
+  dup(2);
+  close(fd);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+  if(buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+}
+
+// a program's initialized data is read in from its file when
+// first touched. reading the program file itself into data not
+// yet read in must not deadlock on the file's lock.
+static char progdata[3*PGSIZE] = { 'd' };
+
+void
+execdata(char *s)
+{
+  char *p;
+  int fd;
+
+  p = (char*)PGROUNDUP((uint64)progdata + 1);
+  fd = open("usertests", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  if(read(fd, p, PGSIZE) != PGSIZE){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(p[0] != 0x7f || p[1] != 'E' || p[2] != 'L' || p[3] != 'F'){
+    printf("%s: read wrong data\n", s);
+    exit(1);
+  }
+  if(progdata[0] != 'd'){
+    printf("%s: initialized data wrong\n", s);
+    exit(1);
+  }
+}
+
+static void
+copyprog(char *s, char *src, char *dst)
+{
+  char buf[512];
+  int fd, fd1, n;
+
+  fd = open(src, O_RDONLY);
+  fd1 = open(dst, O_CREATE|O_TRUNC|O_WRONLY);
+  if(fd < 0 || fd1 < 0){
+    printf("%s: open %s or %s failed\n", s, src, dst);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      printf("%s: write %s failed\n", s, dst);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(fd1);
+}
+
+// run prog with stdin from "xtext-in", and check that it
+// writes want to stdout.
+static void
+runprog(char *s, char *prog, char *arg, char *want)
+{
+  char *argv[] = { prog, arg, 0 };
+  char buf[16];
+  int fd, n, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    open("xtext-in", O_RDONLY);
+    close(1);
+    open("xtext-out", O_CREATE|O_TRUNC|O_WRONLY);
+    exec(prog, argv);
+    exit(1);
+  }
+  wait(&xstatus);
+  fd = open("xtext-out", O_RDONLY);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(xstatus != 0 || n != strlen(want) || memcmp(buf, want, n) != 0){
+    printf("%s: %s didn't run right\n", s, prog);
+    exit(1);
+  }
+}
+
+// program text comes from the page cache, so running a program
+// that has been rewritten must run the new one.
+void
+exectext(char *s)
+{
+  int fd;
+
+  fd = open("xtext-in", O_CREATE|O_TRUNC|O_WRONLY);
+  if(fd < 0 || write(fd, "in\n", 3) != 3){
+    printf("%s: create xtext-in failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  copyprog(s, "echo", "xtext");
+  runprog(s, "xtext", "hi", "hi\n");
+  runprog(s, "xtext", "again", "again\n");
+  copyprog(s, "cat", "xtext");
+  runprog(s, "xtext", 0, "in\n");
+
+  unlink("xtext");
+  unlink("xtext-in");
+  unlink("xtext-out");
+}
+
+// a running program's file can't be opened for writing, so
+// rewriting it can't change the program that is running.
+void
+exectxtbusy(char *s)
+{
+  char *argv[] = { "xtext", 0 };
+  int in[2], out[2], fd, pid, xstatus;
+  char c;
+
+  copyprog(s, "cat", "xtext");
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    exec("xtext", argv);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+
+  // once cat echoes a byte, it is running.
+  if(write(in[1], "a", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'a'){
+    printf("%s: xtext didn't start\n", s);
+    exit(1);
+  }
+  if((fd = open("xtext", O_WRONLY)) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("xtext", O_CREATE|O_TRUNC|O_WRONLY)) >= 0){
+    printf("%s: truncated running program\n", s);
+    exit(1);
+  }
+  if((fd = open("xtext", O_RDONLY)) < 0){
+    printf("%s: open running program for reading failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(write(in[1], "b", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'b'){
+    printf("%s: running program changed\n", s);
+    exit(1);
+  }
+  close(in[1]);
+  wait(&xstatus);
+  close(out[0]);
+  if(xstatus != 0){
+    printf("%s: xtext failed\n", s);
+    exit(1);
+  }
+
+  // once it has exited, the file can be rewritten.
+  copyprog(s, "echo", "xtext");
+  unlink("xtext");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -788,6 +1044,49 @@ pipe1(char *s)
   }
 }
 
+// many readers and writers on one pipe. they are woken one at
+// a time, so each must pass the wakeup on, or some would sleep
+// forever.
+void
+pipemany(char *s)
+{
+  enum { N=6, K=1500 };
+  int fds[2], i, j, pid, xstatus;
+  char buf[K];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork() failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(i < N){
+        // read K bytes, in small pieces.
+        for(j = 0; j < K; j += xstatus)
+          if((xstatus = read(fds[0], buf, K - j < 100 ? K - j : 100)) <= 0)
+            exit(1);
+        exit(0);
+      }
+      memset(buf, i, K);
+      exit(write(fds[1], buf, K) == K ? 0 : 1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < 2*N; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: reader or writer failed\n", s);
+      exit(1);
+    }
+  }
+}
+
 
 // test if child is killed (status = -1)
 void
@@ -2429,6 +2728,31 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// deep recursion grows the stack, one page at a time,
+// up to USERSTACK pages.
+static int
+recurse(int n)
+{
+  volatile char buf[1024];
+
+  buf[0] = 0;
+  buf[sizeof(buf)-1] = n;
+  if(n == 0)
+    return buf[0];
+  return recurse(n - 1) + (buf[sizeof(buf)-1] == (char)n);
+}
+
+void
+stackgrow(char *s)
+{
+  enum { DEPTH=USERSTACK*PGSIZE/2/1024 };
+
+  if(recurse(DEPTH) != DEPTH){
+    printf("%s: deep stack lost data\n", s);
+    exit(1);
+  }
+}
+
 // check that writes to a few forbidden addresses
 // cause a fault, e.g. process's text and TRAMPOLINE.
 void
@@ -2571,84 +2895,1048 @@ sbrk8000(char *s)
 
 
 
-// regression test. test whether exec() leaks memory if one of the
-// arguments is invalid. the test passes if the kernel doesn't panic.
+// sbrk() should only move the break; pages are allocated
+// when first touched, by the process or by the kernel.
 void
-badarg(char *s)
+sbrklazy(char *s)
 {
-  for(int i = 0; i < 50000; i++){
-    char *argv[2];
-    argv[0] = (char*)0xffffffff;
-    argv[1] = 0;
-    exec("echo", argv);
+  enum { BIG=100*1024*1024, STRIDE=1024*1024 };
+  char *a, *p;
+  int fds[2];
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += STRIDE)
+    *p = 'a' + ((p - a) / STRIDE) % 26;
+  for(p = a; p < a + BIG; p += STRIDE){
+    if(*p != 'a' + ((p - a) / STRIDE) % 26 || p[PGSIZE] != 0){
+      printf("%s: lazy page has wrong contents\n", s);
+      exit(1);
+    }
+  }
+
+  // have the kernel fault in an untouched page.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], a + BIG - 1, 1) != 1 || a[BIG-1] != 'x'){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(sbrk(-BIG) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-%d) failed\n", s, BIG);
+    exit(1);
   }
-  
-  exit(0);
 }
 
-struct test {
-  void (*f)(char *);
-  char *s;
-} quicktests[] = {
-  {copyin, "copyin"},
-  {copyout, "copyout"},
-  {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
-  {copyinstr3, "copyinstr3"},
-  {rwsbrk, "rwsbrk" },
-  {truncate1, "truncate1"},
-  {truncate2, "truncate2"},
-  {truncate3, "truncate3"},
-  {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
-  {opentest, "opentest"},
-  {writetest, "writetest"},
-  {writebig, "writebig"},
-  {createtest, "createtest"},
-  {dirtest, "dirtest"},
-  {exectest, "exectest"},
-  {pipe1, "pipe1"},
-  {killstatus, "killstatus"},
-  {preempt, "preempt"},
-  {exitwait, "exitwait"},
-  {reparent, "reparent" },
-  {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
-  {sharedfd, "sharedfd"},
-  {fourfiles, "fourfiles"},
-  {createdelete, "createdelete"},
-  {unlinkread, "unlinkread"},
-  {linktest, "linktest"},
-  {concreate, "concreate"},
-  {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
-  {bigwrite, "bigwrite"},
-  {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
-  {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
-  {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
-  {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
-  {sbrkarg, "sbrkarg"},
-  {validatetest, "validatetest"},
-  {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
-  {argptest, "argptest"},
-  {stacktest, "stacktest"},
-  {nowrite, "nowrite"},
-  {pgbug, "pgbug" },
+// the kernel copies to and from user memory with loads and stores
+// that may fault: on copy-on-write pages, which must be broken, and
+// on read-only ones, which must make the system call fail.
+void
+copyfault(char *s)
+{
+  enum { N=3*PGSIZE };
+  char *buf, *p;
+  int fd, pid, xstatus, i;
+
+  buf = sbrk(N + PGSIZE);
+  for(i = 0; i < N; i++)
+    buf[i] = i % 251;
+  unlink("copyfault");
+  fd = open("copyfault", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // into memory shared with the parent, at an odd offset.
+    p = buf + 7;
+    memset(buf, 0, N + PGSIZE);
+    fd = open("copyfault", O_RDONLY);
+    if(fd < 0 || read(fd, p, N) != N){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(p[i] != (char)(i % 251)){
+        printf("%s: wrong data\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+    // into our own text.
+    fd = open("copyfault", O_RDONLY);
+    if(fd < 0 || read(fd, (char*)copyfault, 64) > 0){
+      printf("%s: read into text succeeded\n", s);
+      exit(1);
+    }
+    close(fd);
+    exit(0);
+  }
+  wait(&xstatus);
+  unlink("copyfault");
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: parent's memory was modified\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(N + PGSIZE));
+  if(xstatus != 0)
+    exit(xstatus);
+}
+
+// mmap() a file shared and private; stores through a shared
+// mapping must reach the file, and through a private one not.
+void
+mmaptest(char *s)
+{
+  enum { N=2*PGSIZE+100 };
+  char *buf, *p, *q;
+  int fd, i, pid, xstatus;
+
+  buf = malloc(N);
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(memcmp(p, buf, N) != 0 || memcmp(q, buf, N) != 0){
+    printf("%s: mapped wrong data\n", s);
+    exit(1);
+  }
+  // past the end of the file, the last page is zero.
+  if(p[N] != 0 || q[N] != 0){
+    printf("%s: page past end of file not zero\n", s);
+    exit(1);
+  }
+
+  q[0] = 'Q';
+  p[1] = 'P';
+  if(q[1] != 'b'){
+    // q's first page is q's own since the store to it.
+    printf("%s: private mapping saw a shared store\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[PGSIZE] = 'C';
+    q[PGSIZE] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[PGSIZE] != 'C' || q[PGSIZE] != buf[PGSIZE]){
+    printf("%s: fork shared the mappings wrongly\n", s);
+    exit(1);
+  }
+
+  if(munmap(p, N) < 0 || munmap(q, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, N) != N){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+  if(buf[0] != 'a' || buf[1] != 'P' || buf[PGSIZE] != 'C'){
+    printf("%s: shared stores didn't reach the file\n", s);
+    exit(1);
+  }
+  free(buf);
+}
+
+// read() and write() of one file to and from an untouched
+// mapping of another, whose pages the copies fault in.
+void
+mmapcopy(char *s)
+{
+  enum { N=2*PGSIZE };
+  char *buf, *p;
+  int fa, fb, i;
+
+  buf = malloc(N);
+  unlink("mmapa");
+  unlink("mmapb");
+  fa = open("mmapa", O_CREATE|O_RDWR);
+  fb = open("mmapb", O_CREATE|O_RDWR);
+  if(fa < 0 || fb < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fa, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'z', N);
+  if(write(fb, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fb, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  close(fa);
+  if((fa = open("mmapa", O_RDWR)) < 0 || read(fa, p, N) != N){
+    printf("%s: read into a mapping failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a' || p[N-1] != 'a' + (N-1) % 26){
+    printf("%s: read into a mapping got wrong data\n", s);
+    exit(1);
+  }
+  if(munmap(p, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ, MAP_SHARED, fb, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  close(fa);
+  if((fa = open("mmapa", O_RDWR)) < 0 || write(fa, p, N) != N){
+    printf("%s: write from a mapping failed\n", s);
+    exit(1);
+  }
+  munmap(p, N);
+  close(fa);
+  close(fb);
+  unlink("mmapa");
+  unlink("mmapb");
+  free(buf);
+}
+
+// a shared-memory segment is the same memory in every process
+// that maps it, before and after fork().
+void
+shmtest(char *s)
+{
+  enum { N=3*PGSIZE };
+  char *p, *q;
+  int fd, pid, xstatus;
+
+  if((fd = shmcreate(N)) < 0){
+    printf("%s: shmcreate failed\n", s);
+    exit(1);
+  }
+  if(read(fd, &xstatus, 1) != -1){
+    printf("%s: read of a segment succeeded\n", s);
+    exit(1);
+  }
+  if(mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0) != (void*)-1 ||
+     mmap(0, N+PGSIZE, PROT_READ, MAP_SHARED, fd, 0) != (void*)-1){
+    printf("%s: bad mmap of a segment succeeded\n", s);
+    exit(1);
+  }
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 0 || p[N-1] != 0){
+    printf("%s: segment not zeroed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // a second mapping in the child sees the same pages.
+    q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 2*PGSIZE);
+    if(q == (char*)-1)
+      exit(1);
+    p[0] = 'C';
+    q[1] = 'Q';
+    exit(0);
+  }
+  p[PGSIZE] = 'P';
+  wait(&xstatus);
+  if(xstatus != 0 || p[0] != 'C' || p[2*PGSIZE+1] != 'Q'){
+    printf("%s: parent didn't see the child's stores\n", s);
+    exit(1);
+  }
+
+  // the mapping keeps the segment after close().
+  close(fd);
+  if(p[PGSIZE] != 'P'){
+    printf("%s: segment lost after close\n", s);
+    exit(1);
+  }
+  if(munmap(p, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+}
+
+// madvise(): DONTNEED pages come back zero, WILLNEED and POPULATE
+// fault pages in without changing what they hold.
+void
+madvisetest(char *s)
+{
+  enum { N=8*PGSIZE };
+  char *a, *m;
+  int i, pid, xstatus;
+
+  a = sbrk(N + PGSIZE);
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)PGROUNDUP((uint64)a);
+  for(i = 0; i < N; i += PGSIZE)
+    a[i] = 'x';
+
+  if(madvise(a + PGSIZE, 2*PGSIZE, MADV_DONTNEED) < 0){
+    printf("%s: madvise DONTNEED failed\n", s);
+    exit(1);
+  }
+  if(a[0] != 'x' || a[PGSIZE] != 0 || a[2*PGSIZE] != 0 || a[3*PGSIZE] != 'x'){
+    printf("%s: DONTNEED dropped the wrong pages\n", s);
+    exit(1);
+  }
+
+  // POPULATE in a fork() child breaks copy-on-write up front.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(madvise(a, N, MADV_POPULATE) < 0 || madvise(a, N, MADV_WILLNEED) < 0)
+      exit(1);
+    a[0] = 'c';
+    exit(a[3*PGSIZE] == 'x' && a[PGSIZE] == 0 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 'x'){
+    printf("%s: POPULATE in child went wrong\n", s);
+    exit(1);
+  }
+
+  // bad ranges.
+  if(madvise(a + 1, PGSIZE, MADV_DONTNEED) != -1 ||
+     madvise(a, N + 64*PGSIZE, MADV_DONTNEED) != -1 ||
+     madvise(a, PGSIZE, 99) != -1){
+    printf("%s: bad madvise succeeded\n", s);
+    exit(1);
+  }
+
+  // free() of a big block hands its pages back; malloc() must
+  // still work on the block afterwards.
+  m = malloc(16*PGSIZE);
+  memset(m, 'm', 16*PGSIZE);
+  free(m);
+  m = malloc(16*PGSIZE);
+  for(i = 0; i < 16*PGSIZE; i++)
+    m[i] = i;
+  free(m);
+}
+
+// a large heap may be backed by 2 MB megapages. fork() must share
+// them copy-on-write, and a write or a partial sbrk(-n) must only
+// affect the pages involved.
+void
+sbrkmega(char *s)
+{
+  enum { MEGA=2*1024*1024, BIG=4*MEGA };
+  char *a, *p;
+  uint64 top;
+  int pid, xstatus;
+
+  top = (uint64) sbrk(0);
+  sbrk(MEGA - top % MEGA);   // start on a 2 MB boundary
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += PGSIZE)
+    *p = 'a';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + BIG; p += 3*PGSIZE)
+      *p = 'b';
+    for(p = a; p < a + BIG; p += PGSIZE){
+      if(*p != ((p - a) % (3*PGSIZE) == 0 ? 'b' : 'a')){
+        printf("%s: child saw wrong contents\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + BIG; p += PGSIZE){
+    if(*p != 'a'){
+      printf("%s: child's write showed up in parent\n", s);
+      exit(1);
+    }
+  }
+
+  // cut the last megapage in half, then grow it back.
+  sbrk(-(MEGA/2));
+  sbrk(MEGA/2);
+  if(a[BIG - MEGA/2] != 0 || a[BIG - MEGA/2 - PGSIZE] != 'a'){
+    printf("%s: wrong contents after shrinking a megapage\n", s);
+    exit(1);
+  }
+  sbrk(-BIG);
+}
+
+// kfree() keeps pages on the freeing hart for its next kalloc().
+// once processes on several harts have allocated and freed
+// memory at once, all of it must be free again, wherever it's
+// parked.
+void
+kcache(char *s)
+{
+  enum { NCHILD=4, N=64 };
+  struct kstat ks0, ks1;
+  char *a;
+  int i, j, pid, xstatus;
+
+  if(kstat(&ks0) < 0){
+    printf("%s: kstat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      a = sbrk(N*PGSIZE);
+      for(j = 0; j < N; j++)
+        a[j*PGSIZE] = j;
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  // the children's memory is freed in the background.
+  kstat(&ks1);
+  for(i = 0; i < 100 && ks1.freepages + N < ks0.freepages; i++){
+    sleep(1);
+    kstat(&ks1);
+  }
+  if(ks1.freepages + N < ks0.freepages){
+    printf("%s: %ld free pages went missing\n", s, ks0.freepages - ks1.freepages);
+    exit(1);
+  }
+}
+
+// a process that fills most of memory a page at a time breaks up
+// nearly every free 2 MB block; once its pages are freed, their
+// buddies must merge back into whole blocks, so that a process
+// touching fresh 2 MB stretches of heap gets megapages again.
+void
+buddymerge(char *s)
+{
+  enum { CHUNK=1024*1024, MEGA=2*1024*1024 };
+  struct kstat ks0, ks1;
+  uint64 n, top;
+  char *a, *p;
+  int i, pid, xstatus;
+
+  kstat(&ks0);
+  if(ks0.freemega == 0){
+    printf("%s: no free 2 MB blocks\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // touching each chunk as it's added keeps the heap
+    // from being given whole megapages.
+    for(n = 0; n < ks0.freepages * 3 / 4 * PGSIZE; n += CHUNK){
+      if((a = sbrk(CHUNK)) == (char*)-1)
+        exit(1);
+      for(p = a; p < a + CHUNK; p += PGSIZE)
+        *p = 1;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+
+  // the child's memory is freed in the background.
+  kstat(&ks1);
+  for(i = 0; i < 100 && ks1.freepages + 64 < ks0.freepages; i++){
+    sleep(1);
+    kstat(&ks1);
+  }
+
+  // without merging, about a quarter of the blocks would be
+  // left; ask for half of them.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    n = ks0.freemega / 2;
+    top = (uint64) sbrk(0);
+    sbrk(MEGA - top % MEGA);
+    if((a = sbrk(n * MEGA)) == (char*)-1)
+      exit(1);
+    kstat(&ks0);
+    for(p = a; p < a + n * MEGA; p += MEGA)
+      *p = 1;
+    kstat(&ks1);
+    if(ks1.freepages + n * 512 / 2 > ks0.freepages){
+      printf("%s: touching %ld fresh 2 MB stretches took only %ld pages\n",
+             s, n, ks0.freepages - ks1.freepages);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+}
+
+// reading fresh heap memory maps the shared zero page, so it
+// must not use up free memory; writing gets a private page.
+void
+zeroread(char *s)
+{
+  enum { N=512 };
+  struct kstat ks0, ks1;
+  char *a;
+  int i, sum;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  kstat(&ks0);
+  sum = 0;
+  for(i = 0; i < N; i++)
+    sum += ((volatile char*)a)[i*PGSIZE];
+  kstat(&ks1);
+  if(sum != 0){
+    printf("%s: fresh memory isn't zero\n", s);
+    exit(1);
+  }
+  // allow for page-table pages and other harts' allocations.
+  if(ks1.freepages + N/4 < ks0.freepages){
+    printf("%s: reading %d pages used %ld\n", s, N, ks0.freepages - ks1.freepages);
+    exit(1);
+  }
+  a[PGSIZE] = 1;
+  if(a[0] != 0 || a[PGSIZE] != 1 || a[2*PGSIZE] != 0){
+    printf("%s: write to a zero page went astray\n", s);
+    exit(1);
+  }
+  // the rest of the writes each need a page of their own.
+  kstat(&ks0);
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+  kstat(&ks1);
+  for(i = 0; i < N; i++){
+    if(a[i*PGSIZE] != (char)i){
+      printf("%s: pages written over zero pages share memory\n", s);
+      exit(1);
+    }
+  }
+  if(ks1.freepages + N/2 > ks0.freepages){
+    printf("%s: writing %d zero pages used only %ld\n", s, N, ks0.freepages - ks1.freepages);
+    exit(1);
+  }
+  sbrk(-N*PGSIZE);
+}
+
+// the kernel copies copy-on-write pages through its direct map
+// of RAM, built from 2 MB pages wherever it can be. pages copied
+// from and to all over memory must arrive intact.
+void
+megacopy(char *s)
+{
+  struct kstat ks;
+  uint64 i, n;
+  char *a;
+  int pid, xstatus;
+
+  kstat(&ks);
+  n = ks.freepages / 3;
+  a = sbrk(n*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    *(uint64*)(a + i*PGSIZE) = i;
+    *(uint64*)(a + i*PGSIZE + PGSIZE - 8) = ~i;
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      a[i*PGSIZE + PGSIZE/2] = 1;
+      if(*(uint64*)(a + i*PGSIZE) != i || *(uint64*)(a + i*PGSIZE + PGSIZE - 8) != ~i){
+        printf("%s: page %ld copied wrongly\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < n; i++){
+    if(a[i*PGSIZE + PGSIZE/2] != 0 || *(uint64*)(a + i*PGSIZE) != i){
+      printf("%s: parent's page %ld changed\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-(int)(n*PGSIZE));
+}
+
+// a copy-on-write fault by the last process sharing a page just
+// makes it writable again, without using memory, and a read()
+// that fills a whole shared page (which needn't copy it first)
+// leaves the other sharer's copy alone.
+void
+cowfast(char *s)
+{
+  enum { N=64 };
+  struct kstat ks0, ks1;
+  char *buf, *p, c;
+  uint64 top;
+  int fd, fds[2], i, pid, xstatus;
+
+  top = (uint64) sbrk(0);
+  sbrk(PGSIZE - top % PGSIZE);
+  buf = sbrk((N+2)*PGSIZE);
+  for(i = 0; i < N+2; i++)
+    buf[i*PGSIZE] = 'a';
+
+  // a file whose first page is in the page cache, which
+  // read() copies out a page at a time.
+  p = sbrk(PGSIZE);
+  memset(p, 'f', PGSIZE);
+  unlink("cowfast");
+  fd = open("cowfast", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, p, PGSIZE) != PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  sbrk(-PGSIZE);
+  if((p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0)) == (char*)-1 || p[0] != 'f'){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // wait for the parent to take its own copies of the
+    // pages after the first two.
+    if(read(fds[0], &c, 1) != 1)
+      exit(1);
+    kstat(&ks0);
+    kstat(&ks0);   // the first may have faulted on the stack
+    for(i = 2; i < N+2; i++)
+      buf[i*PGSIZE] = 'c';
+    kstat(&ks1);
+    if(ks1.freepages + N/2 <= ks0.freepages){
+      printf("%s: sole owner's %d pages took %ld more\n", s, N, ks0.freepages - ks1.freepages);
+      exit(1);
+    }
+    // wait for the parent's read() into buf[PGSIZE].
+    if(read(fds[0], &c, 1) != 1)
+      exit(1);
+    if(buf[0] != 'a' || buf[PGSIZE] != 'a' || buf[2*PGSIZE] != 'c'){
+      printf("%s: child saw the parent's stores\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+
+  for(i = 2; i < N+2; i++)
+    buf[i*PGSIZE] = 'p';
+  write(fds[1], "x", 1);
+
+  fd = open("cowfast", O_RDONLY);
+  if(fd < 0 || read(fd, buf + PGSIZE, PGSIZE) != PGSIZE){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < PGSIZE; i++){
+    if(buf[PGSIZE + i] != 'f'){
+      printf("%s: read the wrong data\n", s);
+      exit(1);
+    }
+  }
+  write(fds[1], "x", 1);
+  wait(&xstatus);
+  close(fds[0]);
+  close(fds[1]);
+  unlink("cowfast");
+  if(xstatus != 0)
+    exit(xstatus);
+  if(buf[0] != 'a' || buf[2*PGSIZE] != 'p'){
+    printf("%s: parent saw the child's store\n", s);
+    exit(1);
+  }
+  sbrk(-((N+2)*PGSIZE));
+}
+
+// filling fresh memory, or memory shared with a fork() parent,
+// from start to end should take far fewer faults than pages.
+static void
+faultfill(char *s, char *what, char *a, int n)
+{
+  struct rusage ru0, ru1;
+  int i;
+
+  getrusage(&ru0);
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE] = i;
+  getrusage(&ru1);
+  if(ru1.nfaultpages - ru0.nfaultpages < n || ru1.nfault - ru0.nfault > n/2){
+    printf("%s: %s: %ld faults for %ld pages\n", s, what,
+           ru1.nfault - ru0.nfault, ru1.nfaultpages - ru0.nfaultpages);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(a[i*PGSIZE] != (char)i){
+      printf("%s: %s: page %d lost its contents\n", s, what, i);
+      exit(1);
+    }
+  }
+}
+
+void
+faultaround(char *s)
+{
+  enum { N=64 };
+  char *a;
+  int pid, xstatus;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  faultfill(s, "fresh memory", a, N);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    faultfill(s, "copy-on-write", a, N);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  sbrk(-N*PGSIZE);
+}
+
+// run n children that each compute for loops iterations, and
+// return how many ticks they took to finish.
+static int
+runqtime(char *s, int n, uint64 loops)
+{
+  volatile uint64 x;
+  uint64 j;
+  int i, pid, xstatus, t0;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0, x = 0; j < loops; j++)
+        x += j;
+      exit(0);
+    }
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  return uptime() - t0;
+}
+
+// fork() queues children on the parent's hart; the other harts
+// must take some of them rather than sit idle, so that one child
+// per hart finishes in not much more time than one alone.
+void
+runqsteal(char *s)
+{
+  struct kstat ks;
+  uint64 loops;
+  int t1, tn;
+
+  kstat(&ks);
+  if(ks.ncpu < 2)
+    return;   // no one to steal
+  for(loops = 1<<20; (t1 = runqtime(s, 1, loops)) < 10; loops *= 2)
+    ;
+  tn = runqtime(s, ks.ncpu, loops);
+  // on one hart they'd take ncpu times as long.
+  if(2 * tn >= (ks.ncpu + 1) * t1){
+    printf("%s: %ld children took %d ticks, one alone %d\n", s, ks.ncpu, tn, t1);
+    exit(1);
+  }
+}
+
+// run enough short-lived processes that the kernel runs out of
+// ASIDs (at most NASID a generation) and hands them out again,
+// several times over. a process must never see another's memory
+// through TLB entries left under a reused ASID.
+void
+asidwrap(char *s)
+{
+  char *buf;
+  int i, pid, xstatus;
+
+  buf = sbrk(PGSIZE);
+  buf[0] = 'p';
+  for(i = 0; i < 3*NASID; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(buf[0] != 'p')
+        exit(1);
+      buf[0] = 'c';
+      if(buf[0] != 'c')
+        exit(1);
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0 || buf[0] != 'p'){
+      printf("%s: saw another process's memory after %d forks\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-PGSIZE);
+}
+
+// the kernel must not copy to or from the stack guard page
+// on a process's behalf, any more than the process may touch it.
+void
+guardcopy(char *s)
+{
+  char *guard;
+  int fd, fds[2];
+
+  guard = (char*)PGROUNDDOWN(r_sp()) - USERSTACK*PGSIZE;
+  fd = open("guardcopy", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("guardcopy", O_RDWR);
+  if(read(fd, guard + 100, 10) != -1){
+    printf("%s: read() into the guard page succeeded\n", s);
+    exit(1);
+  }
+  if(write(fd, guard + 100, 10) != -1){
+    printf("%s: write() from the guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("guardcopy");
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], guard + PGSIZE - 1, 1) != -1){
+    printf("%s: pipe read() into the guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// regression test. test whether exec() leaks memory if one of the
+// arguments is invalid. the test passes if the kernel doesn't panic.
+void
+badarg(char *s)
+{
+  for(int i = 0; i < 50000; i++){
+    char *argv[2];
+    argv[0] = (char*)0xffffffff;
+    argv[1] = 0;
+    exec("echo", argv);
+  }
+  
+  exit(0);
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} quicktests[] = {
+  {copyin, "copyin"},
+  {copyout, "copyout"},
+  {copyinstr1, "copyinstr1"},
+  {copyinstr2, "copyinstr2"},
+  {copyinstr3, "copyinstr3"},
+  {rwsbrk, "rwsbrk" },
+  {truncate1, "truncate1"},
+  {truncate2, "truncate2"},
+  {truncate3, "truncate3"},
+  {openiputtest, "openiput"},
+  {exitiputtest, "exitiput"},
+  {iputtest, "iput"},
+  {opentest, "opentest"},
+  {writetest, "writetest"},
+  {writebig, "writebig"},
+  {createtest, "createtest"},
+  {dirtest, "dirtest"},
+  {exectest, "exectest"},
+  {spawntest, "spawntest"},
+  {execdata, "execdata"},
+  {exectext, "exectext"},
+  {exectxtbusy, "exectxtbusy"},
+  {pipe1, "pipe1"},
+  {pipemany, "pipemany"},
+  {killstatus, "killstatus"},
+  {preempt, "preempt"},
+  {exitwait, "exitwait"},
+  {reparent, "reparent" },
+  {twochildren, "twochildren"},
+  {forkfork, "forkfork"},
+  {forkforkfork, "forkforkfork"},
+  {reparent2, "reparent2"},
+  {mem, "mem"},
+  {sharedfd, "sharedfd"},
+  {fourfiles, "fourfiles"},
+  {createdelete, "createdelete"},
+  {unlinkread, "unlinkread"},
+  {linktest, "linktest"},
+  {concreate, "concreate"},
+  {linkunlink, "linkunlink"},
+  {subdir, "subdir"},
+  {bigwrite, "bigwrite"},
+  {bigfile, "bigfile"},
+  {fourteen, "fourteen"},
+  {rmdot, "rmdot"},
+  {dirfile, "dirfile"},
+  {iref, "iref"},
+  {forktest, "forktest"},
+  {sbrkbasic, "sbrkbasic"},
+  {sbrkmuch, "sbrkmuch"},
+  {kernmem, "kernmem"},
+  {MAXVAplus, "MAXVAplus"},
+  {sbrkfail, "sbrkfail"},
+  {sbrkarg, "sbrkarg"},
+  {validatetest, "validatetest"},
+  {bsstest, "bsstest"},
+  {bigargtest, "bigargtest"},
+  {argptest, "argptest"},
+  {stacktest, "stacktest"},
+  {stackgrow, "stackgrow"},
+  {guardcopy, "guardcopy"},
+  {nowrite, "nowrite"},
+  {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
+  {sbrklazy, "sbrklazy"},
+  {sbrkmega, "sbrkmega"},
+  {copyfault, "copyfault"},
+  {mmaptest, "mmaptest"},
+  {mmapcopy, "mmapcopy"},
+  {shmtest, "shmtest"},
+  {madvisetest, "madvisetest"},
+  {kcache, "kcache"},
+  {buddymerge, "buddymerge"},
+  {zeroread, "zeroread"},
+  {megacopy, "megacopy"},
+  {cowfast, "cowfast"},
+  {faultaround, "faultaround"},
+  {runqsteal, "runqsteal"},
+  {asidwrap, "asidwrap"},
   {badarg, "badarg" },
 
   { 0, 0},
@@ -2939,6 +4227,78 @@ outofinodes(char *s)
   }
 }
 
+// use more memory than the machine has, so that some of it
+// has to go to swap, and check that it all comes back,
+// including through the kernel's copyout().
+void
+swapbig(char *s)
+{
+  enum { BIG=150*1024*1024 };
+  char *a, *p;
+  int fds[2];
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+
+  for(p = a; p < a + BIG; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong contents at %p\n", s, p);
+      exit(1);
+    }
+  }
+
+  // read() into the first page, likely out on swap by now.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], a, 1) != 1 || a[0] != 'x'){
+    printf("%s: read into swapped page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  sbrk(-BIG);
+}
+
+// big processes exiting one after another. their memory is freed
+// after wait() returns, and must be back before the next needs it.
+void
+exitbig(char *s)
+{
+  enum { BIG=64*1024*1024 };
+  char *a;
+  int i, pid, xstatus;
+  uint64 off;
+
+  for(i = 0; i < 8; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if((a = sbrk(BIG)) == (char*)-1)
+        exit(1);
+      for(off = 0; off < BIG; off += PGSIZE)
+        a[off] = 1;
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child %d failed\n", s, i);
+      exit(1);
+    }
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2946,6 +4306,8 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swapbig, "swapbig"},
+  {exitbig, "exitbig"},
     
   { 0, 0},
 };
@@ -36,3 +36,10 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("spawn");
+entry("mmap");
+entry("munmap");
+entry("shmcreate");
+entry("madvise");
+entry("kstat");
+entry("getrusage");